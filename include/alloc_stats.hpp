@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts of the global operator new calls made by the process, including
+// the ones made inside terra, since counting was switched on.
+struct alloc_counts
+{
+    size_t allocations;
+    size_t bytes;
+};
+
+// Switches counting on for the rest of the process. Until then operator new
+// only checks a flag.
+void count_heap_allocations();
+alloc_counts heap_allocations();
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+// Maps `bytes` of zeroed memory straight from the OS. Requests of a huge
+// page or more try explicit huge pages first and fall back to advising
+// transparent huge pages, `huge` reports whether either succeeded.
+void* map_pages(size_t bytes, bool& huge);
+void unmap_pages(void* pages, size_t bytes);
+
+// Maps `bytes` of zeroed memory backed by an unlinked scratch file in
+// `directory`, so the kernel can write the pages back to the file rather
+// than to swap when memory runs short. Released with unmap_pages.
+void* map_file_pages(const std::string& directory, size_t bytes);
+
+// How a range of pages is about to be walked, passed on to madvise.
+enum struct access_pattern
+{
+    normal,
+    sequential,
+    random
+};
+
+void advise_pages(void* pages, size_t bytes, access_pattern pattern);
+
+// Monotonic arena that hands out memory from large page-backed blocks.
+// Deallocation is a no-op, reset() rewinds the arena while keeping its
+// blocks so that a loop which resets it every iteration stops touching the
+// allocator after the first one. Not thread safe.
+//
+// An arena given a backing directory maps its blocks from scratch files in
+// that directory, which lets buffers larger than memory page in and out.
+class arena : public std::pmr::memory_resource
+{
+public:
+    explicit arena(size_t block_size = 64 << 20);
+    arena(size_t block_size, const std::string& backing);
+    ~arena();
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void reset();
+    void release();
+
+    // Applies to every block, including ones mapped later.
+    void advise(access_pattern pattern);
+
+    size_t used() const
+    {
+        return this->used_bytes;
+    }
+
+    size_t mapped() const
+    {
+        return this->mapped_bytes;
+    }
+
+    size_t huge_mapped() const
+    {
+        return this->huge_bytes;
+    }
+
+    bool file_backed() const
+    {
+        return !this->backing.empty();
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override
+    {
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    struct block_t
+    {
+        std::byte* data;
+        size_t size;
+    };
+
+    size_t block_size;
+    std::string backing;
+    access_pattern pattern;
+    std::vector<block_t> blocks;
+    size_t current;
+    size_t offset;
+
+    size_t used_bytes;
+    size_t mapped_bytes;
+    size_t huge_bytes;
+};
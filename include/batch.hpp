@@ -0,0 +1,11 @@
+#pragma once
+
+#include "argh.h"
+#include "output.hpp"
+#include "scheduler.hpp"
+
+// Runs every job listed in a manifest file on the process scheduler. Each
+// line of the manifest holds the arguments of a single prmrdl invocation,
+// e.g. "lstgtufe 10000 10000 50 100 -o hills.png", blank lines and lines
+// starting with '#' are ignored.
+bool configure_batch(const argh::parser& cmdl, const output& out, scheduler& sched);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "scheduler.hpp"
+
+// Triangulates `points` as vertical strips on the scheduler. Each strip is
+// triangulated by terra's delaunator together with a margin of its
+// neighbours' points, and keeps the triangles whose circumcentre falls in
+// the strip. A kept triangle is Delaunay in the whole set when its
+// circumdisk stays inside the points the strip saw, or otherwise when a
+// search of the points sorted into columns finds the disk empty. Long
+// triangles along the top and bottom of the hull that no strip sees whole
+// come from a separate triangulation of the points near the ends of every
+// column. The result is only used if it has exactly the 2n - 2 - h
+// triangles of a complete triangulation. Returns false when it does not,
+// or when there are too few points or workers for strips to pay off, and
+// the caller triangulates serially.
+//
+// Strips keep their triangles until every count is known, they are then
+// copied into `tris` once, each strip at its own offset. When `indices` is
+// given it receives the same triangles as three node indices each.
+bool triangulate_strips(scheduler& sched,
+                        const std::vector<terra::vec2>& points,
+                        tfloat width,
+                        tfloat radius,
+                        terra::dynarray<terra::triangle>& tris,
+                        std::vector<uint32_t>* indices = nullptr);
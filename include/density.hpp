@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "argh.h"
+#include "lstgtufe.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "scheduler.hpp"
+
+// Relief over the lstgtufe domain in [0, 1], sampled on a regular raster
+// and interpolated bilinearly in between.
+struct density_field
+{
+    size_t columns = 0;
+    size_t rows = 0;
+    tfloat width = 0.0f;
+    tfloat height = 0.0f;
+    std::vector<tfloat> values;
+
+    tfloat at(const terra::vec2& p) const;
+};
+
+// Builds the field from --density <source>:
+//
+//   uplift    terra's uplift over the domain
+//   presolve  a short lstgtufe run on a mesh `coarsen` times coarser
+//   map       a heightmap, --input <raw> or --noise <type> as for simulation
+//
+// Either way a node's relief is the larger of the source value and its
+// slope, both normalised over the raster, so high and steep ground is
+// sampled finely.
+bool build_density(scheduler& sched,
+                   const argh::parser& cmdl,
+                   const lstgtufe_settings& settings,
+                   const std::string& source,
+                   tfloat coarsen,
+                   density_field& field);
+
+// Poisson disc sampling whose radius falls from `max_radius` where the
+// relief is 0 to `min_radius` where it is 1. Two points are at least the
+// mean of their radii apart. `spacing` receives the radius of every point.
+std::vector<terra::vec2> sample_density(const density_field& field,
+                                        tfloat min_radius,
+                                        tfloat max_radius,
+                                        size_t samples,
+                                        std::vector<tfloat>& spacing,
+                                        profile& prof);
+
+// lstgtufe --density <source> [--coarsen <n>], samples at radius where the
+// relief is highest and at radius * coarsen where it is flat. --warm-start
+// and --save-state work as for a plain run, --storage and --reorder are
+// rejected.
+bool lstgtufe_density(const argh::parser& cmdl,
+                      const output& out,
+                      scheduler& sched,
+                      const lstgtufe_settings& settings,
+                      const std::string& source);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "heightmap.hpp"
+#include "scheduler.hpp"
+
+// Layout of a grid padded with a one cell ghost border, so that stencil
+// kernels can read all four neighbours of every interior cell without
+// branching on the edges.
+struct grid_layout
+{
+    grid_layout(size_t width, size_t height) : width(width), height(height), stride(width + 2), rows(height + 2)
+    {
+    }
+
+    size_t index(size_t x, size_t y) const
+    {
+        return (y + 1) * stride + (x + 1);
+    }
+
+    size_t cells() const
+    {
+        return stride * rows;
+    }
+
+    size_t width;
+    size_t height;
+    size_t stride;
+    size_t rows;
+};
+
+typedef std::vector<tfloat> grid_buffer;
+
+// Ghost cells take the height of the nearest edge cell and are never
+// updated, so they act as a fixed base level for the simulation.
+void copy_to_grid(const heightmap& map, const grid_layout& layout, grid_buffer& buffer);
+void copy_from_grid(const grid_buffer& buffer, const grid_layout& layout, heightmap& map);
+
+// Runs `steps` fixed time steps over the rows of a grid. Each of the `phases`
+// kernels is split into bands of rows across the scheduler and completes
+// before the next one starts, so a phase may read any cell written by an
+// earlier phase.
+typedef std::function<void(size_t phase, size_t row_begin, size_t row_end)> row_kernel_t;
+void run_row_tiled(scheduler& sched, size_t rows, size_t steps, size_t phases, const row_kernel_t& kernel);
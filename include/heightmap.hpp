@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "argh.h"
+#include "output.hpp"
+#include "scheduler.hpp"
+
+struct heightmap
+{
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<tfloat> values;
+};
+
+bool load_heightmap(const argh::parser& cmdl, size_t width, size_t height, heightmap& map);
+bool read_heightmap_raw(const std::string& path, size_t width, size_t height, heightmap& map);
+
+bool write_heightmap(scheduler& sched, const output& out, const heightmap& map);
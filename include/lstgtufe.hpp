@@ -1,11 +1,120 @@
 #pragma once
 
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include <terra/terra.hpp>
+
 #include "argh.h"
+#include "arena.hpp"
 #include "output.hpp"
+#include "profile.hpp"
+#include "scheduler.hpp"
+
+// A run has converged once no node moves more than this in one step.
+const tfloat terrain_epsilon = 0.0001f;
+
+// Which arrays lstgtufe keeps beside terra's and where they live. With a
+// directory its own buffers, the neighbour lists and heights_old, are mapped
+// from scratch files there instead of the heap. That is a few bytes per
+// node: the points, areas and everything terra allocates stay on the heap,
+// so a mesh still has to fit in memory. Reordering sorts the nodes along a
+// Hilbert curve so that neighbours are close in memory too.
+struct mesh_storage
+{
+    std::string directory;
+    bool reorder = false;
+
+    // the mesh's own neighbour lists, only --adaptive and shards read them
+    bool neighbours = false;
+};
+
+struct lstgtufe_settings
+{
+    // Poisson disc sampler options
+    size_t width            = 50000;
+    size_t height           = 50000;
+    float radius            = 100.0;
+    size_t samples          = 100;
+
+    // Simulation options
+    float uplift_per_year   = 5.01e-4;
+    float erosion_rate      = 5.61e-7;
+    float time_scale        = 2.5e5;
+    size_t max_itterations  = 300;
+
+    // vary dt between time_scale / 16 and time_scale * 64 instead of
+    // stepping by time_scale every iteration
+    bool adaptive           = false;
+
+    mesh_storage storage;
+};
+
+// Neighbours of every node of the triangulation in compressed rows, the
+// neighbours of node i are neighbours[offsets[i]] .. neighbours[offsets[i + 1]].
+struct mesh_adjacency
+{
+    explicit mesh_adjacency(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        offsets(resource),
+        neighbours(resource)
+    {
+    }
 
-bool configure_lstgtufe(const argh::parser& cmdl, const output& out);
+    std::pmr::vector<uint32_t> offsets;
+    std::pmr::vector<uint32_t> neighbours;
+};
+
+// Everything that only depends on the sampler options, jobs with the same
+// options can share one instance.
+struct lstgtufe_mesh
+{
+    // Reordering the nodes leaves the mesh without a hash_grid.
+    lstgtufe_mesh(scheduler& sched, profile& prof, size_t width, size_t height, float radius, size_t samples, const mesh_storage& storage = {});
+
+    // Builds the mesh over points sampled elsewhere, the mesh has no
+    // hash_grid, lstgtufe_write rasters it from the nearest node instead.
+    // `spacing` holds the sampling radius of every point when it varies
+    // over the domain, `radius` is then the smallest of them. The points
+    // keep the order they come in, `storage.reorder` does not apply.
+    lstgtufe_mesh(scheduler& sched,
+                  profile& prof,
+                  size_t width,
+                  size_t height,
+                  float radius,
+                  std::vector<terra::vec2> points,
+                  std::vector<tfloat> spacing = {},
+                  const mesh_storage& storage = {});
+
+    size_t width;
+    size_t height;
+    float radius;
+
+    // backs the adjacency when the storage names a directory
+    std::unique_ptr<arena> storage;
+
+    std::unique_ptr<terra::hash_grid> hash_grid;
+    std::vector<terra::vec2> points;
+
+    // empty unless the mesh_storage asked for it
+    mesh_adjacency adjacency;
+    terra::dynarray<terra::triangle> tris;
+    terra::undirected_graph graph;
+
+    // per node sampling radius, empty when every node was sampled at radius
+    std::vector<tfloat> spacing;
+    terra::dynarray<tfloat> areas;
+};
+
+bool configure_lstgtufe(const argh::parser& cmdl, const output& out, scheduler& sched);
+void read_lstgtufe_settings(const argh::parser& cmdl, lstgtufe_settings& settings);
 
 void lstgtufe(const output& out,
+              scheduler& sched,
+              profile& prof,
               size_t width = 50000,
               size_t height = 50000,
               float radius = 100.0,
@@ -13,4 +122,21 @@ void lstgtufe(const output& out,
               float uplift_per_year = 5.01e-4,
               float erosion_rate = 5.61e-7,
               float time_scale = 2.5e5,
-              size_t max_itterations = 300);
+              size_t max_itterations = 300,
+              bool adaptive = false,
+              const mesh_storage& storage = {},
+              const std::string& warm_start = {},
+              const std::string& save_state = {});
+
+// Erodes the height field over the mesh until it converges. It starts from
+// `heights` when they hold a height for every node, such as a warm start,
+// and from flat ground otherwise. Once the terra solvers are set up the
+// loop itself only allocates inside terra, the counts of which show up in
+// the profile. Progress is reported to `log`.
+size_t lstgtufe_erode(scheduler& sched,
+                      profile& prof,
+                      const lstgtufe_mesh& mesh,
+                      const lstgtufe_settings& settings,
+                      terra::dynarray<tfloat>& heights,
+                      std::ostream& log = std::cout);
+bool lstgtufe_write(scheduler& sched, const output& out, const lstgtufe_mesh& mesh, const terra::dynarray<tfloat>& heights);
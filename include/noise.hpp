@@ -1,6 +1,28 @@
 #pragma once
 
+#include <string>
+
+#include <terra/terra.hpp>
+
 #include "argh.h"
 #include "output.hpp"
+#include "scheduler.hpp"
+
+struct noise_settings
+{
+    size_t x_off        = 0;
+    size_t y_off        = 0;
+    size_t x_size       = 512;
+    size_t y_size       = 512;
+    float scale         = 0.125f;
+    size_t seed         = 2552;
+    size_t octaves      = 6;
+    float persistence   = 0.5f;
+    float lacunarity    = 2.0f;
+};
+
+bool configure_noise(const argh::parser& cmdl, const output& out, scheduler& sched);
 
-bool configure_noise(const argh::parser& cmdl, const output& out);
+bool read_noise_settings(const argh::parser& cmdl, size_t first, noise_settings& settings);
+bool generate_noise(const std::string& type, const noise_settings& settings, terra::dynarray<tfloat>& noise_set);
+bool noise_write(scheduler& sched, const output& out, const noise_settings& settings, const terra::dynarray<tfloat>& noise_set);
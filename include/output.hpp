@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
 #include <string>
 
 enum struct output_type
@@ -8,8 +11,45 @@ enum struct output_type
     model
 };
 
+// png heightfields are encoded by write_png, any other image by terra.
+enum struct image_format
+{
+    terra,
+    png
+};
+
+// How heightfields are encoded, see write_png.
+struct image_settings
+{
+    image_format format = image_format::terra;
+    size_t bits     = 8;    // 8 or 16 bit grayscale
+    int level       = 6;    // deflate level, 0 stores and 9 compresses hardest
+    size_t raster   = 512;  // width and height of rasterised meshes
+};
+
+// The last four characters of `path` in lower case.
+inline std::string path_extension(const std::string& path)
+{
+    if (path.size() < 4)
+    {
+        return "";
+    }
+
+    std::string extension = path.substr(path.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    return extension;
+}
+
+// Paths ending in .obj get a model, everything else a heightfield.
+inline output_type output_type_of(const std::string& path)
+{
+    return path_extension(path) == ".obj" ? output_type::model : output_type::heightfield;
+}
+
 struct output
 {
     const std::string& path;
     const output_type type;
+    const image_settings image = {};
 };
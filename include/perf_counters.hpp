@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Hardware counters of every thread of the process, read through Linux
+// perf_event_open. The threads are enumerated when the counters are opened,
+// so threads started later, e.g. by a second scheduler, are not counted.
+// Counters the kernel or the machine does not provide are left closed and
+// read as zero, see available().
+class perf_counters
+{
+public:
+    enum counter
+    {
+        cycles,
+        instructions,
+        llc_misses,
+        branch_misses,
+        dtlb_misses,
+        counter_count
+    };
+
+    // Scaled by enabled over running time when the kernel multiplexes.
+    typedef std::array<double, counter_count> values_t;
+
+    perf_counters();
+    ~perf_counters();
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available(counter c) const
+    {
+        return this->opened[c];
+    }
+
+    bool any_available() const;
+
+    // Why the first counter that failed to open did, empty if none failed.
+    const std::string& error() const
+    {
+        return this->first_error;
+    }
+
+    values_t read() const;
+
+    static const char* name(counter c);
+
+private:
+    struct event_t
+    {
+        int fd;
+        counter c;
+    };
+
+    std::vector<event_t> events;
+    std::array<bool, counter_count> opened;
+    std::string first_error;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <terra/terra.hpp>
+
+#include "argh.h"
+#include "output.hpp"
+#include "scheduler.hpp"
+
+// Reads --bits, --png-level and --raster, the format follows the extension
+// of `path`.
+image_settings read_image_settings(const argh::parser& cmdl, const std::string& path);
+
+// Writes `values` as a grayscale PNG, mapping [min, max] onto the full
+// range of the sample depth. The rows are cut into strips that are
+// filtered and deflated in parallel, every strip but the last ends on a
+// sync flush so the strips concatenate into one valid zlib stream.
+// Failures are reported on stdout and return false.
+bool write_png(scheduler& sched,
+               const std::string& path,
+               size_t width,
+               size_t height,
+               const tfloat* values,
+               tfloat min,
+               tfloat max,
+               const image_settings& settings);
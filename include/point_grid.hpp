@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+// Buckets a fixed set of points into square cells for nearest point and
+// radius queries. The points are referenced, not copied, and must outlive
+// the grid.
+class point_grid
+{
+public:
+    static const size_t npos = std::numeric_limits<size_t>::max();
+
+    point_grid(const std::vector<terra::vec2>& points, tfloat cell_size);
+
+    // Index of the point closest to `p`, or npos when the grid is empty.
+    size_t nearest(const terra::vec2& p) const;
+
+    // Calls f(index) for every point within `radius` of `p`.
+    template<typename F>
+    void for_each_within(const terra::vec2& p, tfloat radius, F f) const
+    {
+        if (this->offsets.size() < 2)
+        {
+            return;
+        }
+
+        const size_t x0 = this->column(p.x - radius);
+        const size_t x1 = this->column(p.x + radius);
+        const size_t y0 = this->row(p.y - radius);
+        const size_t y1 = this->row(p.y + radius);
+        const tfloat r2 = radius * radius;
+
+        for (size_t y = y0; y <= y1; ++y)
+        {
+            for (size_t x = x0; x <= x1; ++x)
+            {
+                const size_t cell = y * this->columns + x;
+                for (uint32_t i = this->offsets[cell]; i < this->offsets[cell + 1]; ++i)
+                {
+                    const auto& q = (*this->points)[this->indices[i]];
+                    const tfloat dx = q.x - p.x;
+                    const tfloat dy = q.y - p.y;
+                    if (dx * dx + dy * dy <= r2)
+                    {
+                        f(static_cast<size_t>(this->indices[i]));
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    size_t column(tfloat x) const;
+    size_t row(tfloat y) const;
+
+    const std::vector<terra::vec2>* points;
+    tfloat cell_size;
+    tfloat min_x;
+    tfloat min_y;
+    size_t columns;
+    size_t rows;
+
+    // points of cell c are indices[offsets[c]] .. indices[offsets[c + 1]]
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> indices;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "alloc_stats.hpp"
+#include "perf_counters.hpp"
+
+// Per stage wall time and heap allocation counts of a single run, printed
+// when --profile is passed. With --perf the stages also record hardware
+// counters, reported as IPC and events per node. A disabled profile records
+// nothing.
+class profile
+{
+public:
+    struct stage_t
+    {
+        std::string name;
+        double seconds;
+        size_t allocations;
+        size_t bytes;
+        size_t itterations;
+        size_t nodes;
+        perf_counters::values_t counters;
+    };
+
+    // Records the stage it was created for when it goes out of scope.
+    class scope
+    {
+    public:
+        scope(profile& prof, const std::string& name);
+        ~scope();
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        // Spreads the allocation count over this many iterations.
+        void set_itterations(size_t itterations)
+        {
+            this->itterations = itterations;
+        }
+
+        // Counters are reported per node and per iteration of this many.
+        void set_nodes(size_t nodes)
+        {
+            this->nodes = nodes;
+        }
+
+    private:
+        profile& prof;
+        std::string name;
+        std::chrono::steady_clock::time_point start;
+        alloc_counts start_counts;
+        perf_counters::values_t start_counters;
+        size_t itterations;
+        size_t nodes;
+    };
+
+    explicit profile(bool enabled = false, bool counters = false);
+
+    bool is_enabled() const
+    {
+        return this->enabled;
+    }
+
+    // Free form lines printed after the stage table, e.g. arena usage.
+    void note(const std::string& line);
+
+    void print(std::ostream& out) const;
+
+private:
+    void print_counters(std::ostream& out) const;
+
+    bool enabled;
+    std::unique_ptr<perf_counters> counters;
+    std::vector<stage_t> stages;
+    std::vector<std::string> notes;
+};
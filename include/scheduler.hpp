@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "argh.h"
+
+enum struct affinity_policy
+{
+    none,       // leave placement to the OS
+    compact,    // fill the cores of one NUMA node before moving to the next
+    scatter     // spread workers round robin over the NUMA nodes
+};
+
+// Work-stealing task scheduler shared by every stage of a run. Tasks
+// submitted from a worker go to the back of that worker's own deque and are
+// popped LIFO, idle workers steal FIFO from the front of other deques, and
+// tasks submitted from outside the pool go through a shared queue.
+class scheduler
+{
+public:
+    typedef std::function<void()> task_t;
+
+    // A thread count of zero uses one thread per hardware thread.
+    explicit scheduler(size_t threads = 0, affinity_policy affinity = affinity_policy::none);
+    ~scheduler();
+
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    size_t size() const
+    {
+        return this->workers.size();
+    }
+
+    template<typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& f)
+    {
+        typedef std::invoke_result_t<F> result_t;
+
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        this->push([task]() { (*task)(); });
+
+        return result;
+    }
+
+    // Calls body(chunk_begin, chunk_end) over [begin, end) in chunks of at
+    // least `grain` elements. The calling thread works on the loop as well
+    // and only ever runs chunks of this loop while it waits, so nested loops
+    // cannot deadlock. Loop state is recycled, so once warm a loop makes no
+    // heap allocations.
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, const F& body)
+    {
+        this->run_loop(begin, end, grain, &body, [](const void* f, size_t b, size_t e)
+        {
+            (*static_cast<const F*>(f))(b, e);
+        });
+    }
+
+    // Maps every chunk of [begin, end) to a partial result and folds the
+    // partials in chunk order, so the result does not depend on timing.
+    // The partials are allocated from `scratch`.
+    template<typename T, typename Map, typename Reduce>
+    T parallel_reduce(size_t begin,
+                      size_t end,
+                      size_t grain,
+                      T identity,
+                      Map map,
+                      Reduce reduce,
+                      std::pmr::memory_resource* scratch = std::pmr::get_default_resource())
+    {
+        const size_t chunk = this->chunk_size(begin, end, grain);
+        if (chunk == 0)
+        {
+            return identity;
+        }
+
+        std::pmr::vector<T> partials((end - begin + chunk - 1) / chunk, identity, scratch);
+        this->parallel_for(begin, end, chunk, [&](size_t b, size_t e)
+        {
+            partials[(b - begin) / chunk] = map(b, e);
+        });
+
+        T result = identity;
+        for (const auto& partial : partials)
+        {
+            result = reduce(result, partial);
+        }
+
+        return result;
+    }
+
+    void print_stats(std::ostream& out) const;
+
+private:
+    typedef void (*call_t)(const void* body, size_t begin, size_t end);
+
+    // Growable ring of tasks, unlike std::deque it stops allocating once it
+    // has reached its high water mark.
+    class task_queue
+    {
+    public:
+        bool empty() const
+        {
+            return this->count == 0;
+        }
+
+        void push_back(task_t task);
+        bool pop_back(task_t& task);
+        bool pop_front(task_t& task);
+
+    private:
+        std::vector<task_t> ring;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    struct worker_t
+    {
+        std::thread thread;
+        task_queue tasks;
+        std::mutex mutex;
+
+        int cpu = -1;
+
+        std::atomic<size_t> executed = 0;
+        std::atomic<size_t> steals = 0;
+        std::atomic<size_t> idle_ns = 0;
+    };
+
+    struct loop_t
+    {
+        const void* body;
+        call_t call;
+        size_t begin;
+        size_t end;
+        size_t chunk;
+        size_t chunks;
+
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        std::atomic<size_t> refs;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+    };
+
+    size_t chunk_size(size_t begin, size_t end, size_t grain) const;
+
+    void run_loop(size_t begin, size_t end, size_t grain, const void* body, call_t call);
+    void work_loop(loop_t& loop);
+    loop_t* acquire_loop();
+    void release_loop(loop_t* loop);
+
+    void push(task_t task);
+    bool pop(size_t index, task_t& task);
+    void run(size_t index);
+
+    std::vector<std::unique_ptr<worker_t>> workers;
+    task_queue injected;
+    std::mutex injected_mutex;
+
+    std::vector<std::unique_ptr<loop_t>> loops;
+    std::vector<loop_t*> free_loops;
+    std::mutex loops_mutex;
+
+    std::atomic<size_t> pending;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+bool parse_affinity(const std::string& name, affinity_policy& affinity);
+
+// Reads --threads and --affinity from the command line.
+std::unique_ptr<scheduler> make_scheduler(const argh::parser& cmdl);
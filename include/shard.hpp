@@ -0,0 +1,26 @@
+#pragma once
+
+#include "argh.h"
+#include "lstgtufe.hpp"
+#include "output.hpp"
+#include "scheduler.hpp"
+
+// Splits the lstgtufe domain into vertical strips that each run in their
+// own process. Neighbouring strips share a band of points around the seam
+// between them, the band is sampled once so both strips triangulate the
+// same points there. After every iteration each strip publishes the heights
+// of the band points it owns, and the drainage it routes into the band,
+// through POSIX shared memory and takes the rest from its neighbour. The
+// strips are stitched into one heightfield raster at the end.
+//
+// --overlap sets the half width of the bands, 8 * radius by default. The
+// stitched raster is --raster wide. Options the strips cannot honour, such
+// as --adaptive, --storage or --warm-start, and model outputs are rejected.
+bool lstgtufe_sharded(const argh::parser& cmdl,
+                      const output& out,
+                      scheduler& sched,
+                      const lstgtufe_settings& settings,
+                      size_t shards);
+
+// Entry point of the strip processes started by lstgtufe_sharded.
+bool configure_shard(const argh::parser& cmdl, const output& out, scheduler& sched);
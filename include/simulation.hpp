@@ -1,9 +1,38 @@
 #pragma once
 
 #include "argh.h"
+#include "heightmap.hpp"
 #include "output.hpp"
+#include "scheduler.hpp"
 
-bool configure_simulation(const argh::parser& cmdl, const output& out);
+struct hydraulic_settings
+{
+    size_t steps        = 1000;
+    float dt            = 0.02f;
+    float cell_size     = 1.0f;
+    float rain          = 0.01f;
+    float pipe_area     = 1.0f;
+    float gravity       = 9.81f;
+    float capacity      = 1.0f;
+    float max_depth     = 0.1f;
+    float dissolve      = 0.5f;
+    float deposit       = 1.0f;
+    float evaporation   = 0.015f;
+    float min_tilt      = 0.05f;
+};
 
-void hydraulic_erosion(const output& out);
-void thermal_erosion(const output& out);
+struct thermal_settings
+{
+    size_t steps        = 1000;
+    float dt            = 1.0f;
+    float cell_size     = 1.0f;
+    float talus_angle   = 40.0f;
+    float rate          = 0.25f;
+};
+
+bool configure_simulation(const argh::parser& cmdl, const output& out, scheduler& sched);
+
+// Virtual pipe model water simulation with sediment transport over a grid.
+void hydraulic_erosion(scheduler& sched, const output& out, heightmap& map, const hydraulic_settings& settings);
+// Talus angle based material slippage over a grid.
+void thermal_erosion(scheduler& sched, const output& out, heightmap& map, const thermal_settings& settings);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "argh.h"
+#include "output.hpp"
+#include "scheduler.hpp"
+
+// prmrdl serve <socket> [--cache-mb <n>] [--spill <dir>] [--spill-mb <n>]
+//
+// Long running noise tile server on a Unix domain socket. Every request is
+// a single line and is answered on the same connection:
+//
+//   tile <type> <x_off> <y_off> <size> [lod] [seed] [octaves] [scale]
+//       -> ok <size> <size> <bytes> <hit|miss|shared>\n followed by
+//          size * size float32 heights, or error <reason>\n
+//   stats -> ok <hits> <misses> <shared> <spilled> <evicted> <cached bytes>\n
+//   quit  -> stops the server once the open connections close
+//
+// Offsets are in samples of the requested level of detail, a tile at lod n
+// samples every 2^n units of lod 0. Tiles are generated on the scheduler and
+// kept in an LRU bounded by --cache-mb, evicted tiles are written to the
+// --spill directory when one is given and read back on a later miss. Spill
+// files are bounded by --spill-mb, oldest first, and removed when the
+// server stops.
+// Requests for a tile that is still being generated wait for that tile
+// rather than generating it again. At most 64 connections are served at
+// once, further ones are answered with "error too many connections" and
+// closed.
+bool configure_serve(const argh::parser& cmdl, const output& out, scheduler& sched);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "lstgtufe.hpp"
+#include "scheduler.hpp"
+
+// A converged lstgtufe run, its nodes and their heights, as written by
+// --save-state. `itterations` is what the run from flat ground took, states
+// saved by warm started runs pass on the count they started from.
+struct lstgtufe_state
+{
+    size_t width = 0;
+    size_t height = 0;
+    size_t itterations = 0;
+    std::vector<terra::vec2> points;
+    std::vector<tfloat> heights;
+};
+
+bool write_lstgtufe_state(const std::string& path,
+                          const lstgtufe_mesh& mesh,
+                          const terra::dynarray<tfloat>& heights,
+                          size_t itterations);
+bool read_lstgtufe_state(const std::string& path, lstgtufe_state& state);
+
+// Initial heights for `mesh` from a state over the same domain. They are
+// copied when the state holds the mesh's nodes, otherwise every node takes
+// the inverse distance weighted heights of the saved nodes around it.
+// Returns false when the domains differ.
+bool warm_start_heights(scheduler& sched,
+                        const lstgtufe_mesh& mesh,
+                        const lstgtufe_state& state,
+                        terra::dynarray<tfloat>& heights);
+
+// --warm-start <path>, fills `heights` for lstgtufe_erode to start from.
+// Returns the iterations the saved run took, 0 without a path or a usable
+// state, in which case `heights` is left empty and erosion starts from flat
+// ground.
+size_t lstgtufe_warm_start(scheduler& sched,
+                           const std::string& path,
+                           const lstgtufe_mesh& mesh,
+                           terra::dynarray<tfloat>& heights);
+
+// --save-state <path>, writes the eroded heights for a later --warm-start
+// when `path` is set. Reports the iterations saved against `saved_from`
+// when the run was itself warm started.
+void lstgtufe_save_state(const std::string& path,
+                         const lstgtufe_mesh& mesh,
+                         const terra::dynarray<tfloat>& heights,
+                         size_t itterations,
+                         size_t saved_from);
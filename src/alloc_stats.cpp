@@ -0,0 +1,140 @@
+#include "alloc_stats.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+    std::atomic<bool> counting = false;
+    std::atomic<size_t> allocation_count = 0;
+    std::atomic<size_t> allocation_bytes = 0;
+
+    void count(size_t bytes)
+    {
+        // a plain load, so runs without --profile never touch the shared
+        // counters
+        if (!counting.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void* counted_alloc(size_t bytes)
+    {
+        count(bytes);
+
+        void* p = std::malloc(bytes ? bytes : 1);
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        return p;
+    }
+
+    void* counted_aligned_alloc(size_t bytes, std::align_val_t alignment)
+    {
+        count(bytes);
+
+        const size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+        void* p = _aligned_malloc(bytes ? bytes : 1, align);
+#else
+        // aligned_alloc wants the size to be a multiple of the alignment
+        void* p = std::aligned_alloc(align, ((bytes ? bytes : 1) + align - 1) / align * align);
+#endif
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        return p;
+    }
+
+    void aligned_free(void* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+}
+
+void count_heap_allocations()
+{
+    counting.store(true, std::memory_order_relaxed);
+}
+
+alloc_counts heap_allocations()
+{
+    return { allocation_count.load(std::memory_order_relaxed), allocation_bytes.load(std::memory_order_relaxed) };
+}
+
+void* operator new(size_t bytes)
+{
+    return counted_alloc(bytes);
+}
+
+void* operator new[](size_t bytes)
+{
+    return counted_alloc(bytes);
+}
+
+void* operator new(size_t bytes, std::align_val_t alignment)
+{
+    return counted_aligned_alloc(bytes, alignment);
+}
+
+void* operator new[](size_t bytes, std::align_val_t alignment)
+{
+    return counted_aligned_alloc(bytes, alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    aligned_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    aligned_free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    aligned_free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    aligned_free(p);
+}
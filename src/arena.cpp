@@ -0,0 +1,213 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const size_t huge_page_size = 2 << 20;
+
+    size_t align_up(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void* map_pages(size_t bytes, bool& huge)
+{
+    huge = false;
+
+#ifdef __linux__
+    if (bytes >= huge_page_size)
+    {
+        bytes = align_up(bytes, huge_page_size);
+
+        void* pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pages != MAP_FAILED)
+        {
+            huge = true;
+            return pages;
+        }
+    }
+
+    void* pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+
+    if (bytes >= huge_page_size)
+    {
+        huge = madvise(pages, bytes, MADV_HUGEPAGE) == 0;
+    }
+
+    return pages;
+#else
+    void* pages = ::operator new(bytes, std::align_val_t(huge_page_size));
+    std::fill_n(static_cast<std::byte*>(pages), bytes, std::byte(0));
+
+    return pages;
+#endif
+}
+
+void unmap_pages(void* pages, size_t bytes)
+{
+#ifdef __linux__
+    if (bytes >= huge_page_size)
+    {
+        bytes = align_up(bytes, huge_page_size);
+    }
+
+    munmap(pages, bytes);
+#else
+    (void)bytes;
+    ::operator delete(pages, std::align_val_t(huge_page_size));
+#endif
+}
+
+void* map_file_pages(const std::string& directory, size_t bytes)
+{
+#ifdef __linux__
+    bytes = align_up(bytes, huge_page_size);
+
+    std::string path = directory + "/prmrdl-XXXXXX";
+    const int fd = mkstemp(path.data());
+    if (fd < 0)
+    {
+        throw std::runtime_error("unable to create a scratch file in " + directory);
+    }
+
+    // the mapping keeps the file alive, nothing is left behind on exit
+    unlink(path.c_str());
+
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("unable to grow a scratch file in " + directory);
+    }
+
+    void* pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pages == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+
+    return pages;
+#else
+    (void)directory;
+    bool huge = false;
+
+    return map_pages(bytes, huge);
+#endif
+}
+
+void advise_pages(void* pages, size_t bytes, access_pattern pattern)
+{
+#ifdef __linux__
+    const int advice = pattern == access_pattern::sequential ? MADV_SEQUENTIAL
+                     : pattern == access_pattern::random ? MADV_RANDOM
+                     : MADV_NORMAL;
+    madvise(pages, bytes, advice);
+#else
+    (void)pages;
+    (void)bytes;
+    (void)pattern;
+#endif
+}
+
+arena::arena(size_t block_size) :
+    arena(block_size, "")
+{
+}
+
+arena::arena(size_t block_size, const std::string& backing) :
+    block_size(block_size),
+    backing(backing),
+    pattern(access_pattern::normal),
+    current(0),
+    offset(0),
+    used_bytes(0),
+    mapped_bytes(0),
+    huge_bytes(0)
+{
+}
+
+arena::~arena()
+{
+    this->release();
+}
+
+void arena::reset()
+{
+    this->current = 0;
+    this->offset = 0;
+    this->used_bytes = 0;
+}
+
+void arena::advise(access_pattern pattern)
+{
+    this->pattern = pattern;
+    for (const auto& block : this->blocks)
+    {
+        advise_pages(block.data, block.size, pattern);
+    }
+}
+
+void arena::release()
+{
+    for (const auto& block : this->blocks)
+    {
+        unmap_pages(block.data, block.size);
+    }
+
+    this->blocks.clear();
+    this->reset();
+    this->mapped_bytes = 0;
+    this->huge_bytes = 0;
+}
+
+void* arena::do_allocate(size_t bytes, size_t alignment)
+{
+    // reuse the blocks kept by reset() in order before mapping a new one
+    for (; this->current < this->blocks.size(); ++this->current, this->offset = 0)
+    {
+        const auto& block = this->blocks[this->current];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+        const size_t start = align_up(base + this->offset, alignment) - base;
+        if (start + bytes <= block.size)
+        {
+            this->offset = start + bytes;
+            this->used_bytes += bytes;
+            return block.data + start;
+        }
+    }
+
+    // oversized requests get a block of their own
+    const size_t size = std::max(this->block_size, align_up(bytes + alignment, huge_page_size));
+    bool huge = false;
+    auto data = static_cast<std::byte*>(this->backing.empty() ? map_pages(size, huge) : map_file_pages(this->backing, size));
+    if (this->pattern != access_pattern::normal)
+    {
+        advise_pages(data, size, this->pattern);
+    }
+
+    this->blocks.push_back({ data, size });
+    this->current = this->blocks.size() - 1;
+    this->mapped_bytes += size;
+    this->huge_bytes += huge ? size : 0;
+
+    const uintptr_t base = reinterpret_cast<uintptr_t>(data);
+    const size_t start = align_up(base, alignment) - base;
+    this->offset = start + bytes;
+    this->used_bytes += bytes;
+
+    return data + start;
+}
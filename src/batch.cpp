@@ -0,0 +1,427 @@
+#include "batch.hpp"
+
+#include <chrono>
+#include <compare>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "lstgtufe.hpp"
+#include "noise.hpp"
+#include "png_writer.hpp"
+#include "warm_start.hpp"
+
+namespace
+{
+    typedef std::chrono::steady_clock batch_clock;
+
+    double seconds_since(batch_clock::time_point start)
+    {
+        return std::chrono::duration<double>(batch_clock::now() - start).count();
+    }
+
+    struct batch_job
+    {
+        size_t line = 0;
+        std::vector<std::string> args;
+        argh::parser cmdl;
+        std::string path;
+
+        std::future<void> compute;
+        std::future<void> write;
+
+        // completes compute for jobs started by their mesh group
+        std::promise<void> computed;
+
+        bool shared_mesh = false;
+        size_t itterations = 0;
+        double mesh_time = 0.0;
+        double compute_time = 0.0;
+        double write_time = 0.0;
+    };
+
+    struct mesh_key
+    {
+        size_t width;
+        size_t height;
+        float radius;
+        size_t samples;
+
+        auto operator<=>(const mesh_key&) const = default;
+    };
+
+    mesh_key make_key(const lstgtufe_settings& settings)
+    {
+        return { settings.width, settings.height, settings.radius, settings.samples };
+    }
+
+    typedef std::shared_ptr<const lstgtufe_mesh> mesh_ptr;
+
+    // Options of the lstgtufe verb that change how the mesh is built or how
+    // the run is split up. Jobs share plain meshes only, so a job passing one
+    // of these fails rather than quietly running without it.
+    std::string unsupported_option(const argh::parser& cmdl)
+    {
+        for (const auto* flag : { "reorder" })
+        {
+            if (cmdl[flag] || cmdl(flag))
+            {
+                return flag;
+            }
+        }
+        for (const auto* param : { "storage", "density", "ensemble", "shards" })
+        {
+            if (cmdl(param))
+            {
+                return param;
+            }
+        }
+
+        return "";
+    }
+
+    std::future<void> failed_job(const std::string& reason)
+    {
+        std::promise<void> failed;
+        failed.set_exception(std::make_exception_ptr(std::runtime_error(reason)));
+
+        return failed.get_future();
+    }
+
+    // The lstgtufe jobs that share one set of sampler options. The mesh is
+    // built by a task of its own which then submits the jobs, so no worker
+    // is ever parked waiting for a mesh another worker is building.
+    struct mesh_group
+    {
+        mesh_key key;
+        std::vector<batch_job*> jobs;
+
+        // set when a job of the group steps adaptively
+        bool neighbours = false;
+    };
+
+    bool read_manifest(const std::string& path, std::vector<batch_job>& jobs)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "Unable to open manifest: " << path << std::endl;
+            return false;
+        }
+
+        const auto cmdmode = argh::parser::PREFER_PARAM_FOR_UNREG_OPTION
+                           | argh::parser::SINGLE_DASH_IS_MULTIFLAG;
+
+        std::string line;
+        size_t line_number = 0;
+        while (std::getline(file, line))
+        {
+            ++line_number;
+
+            batch_job job;
+            job.line = line_number;
+            job.args.emplace_back("prmrdl");
+
+            std::istringstream tokens(line);
+            std::string token;
+            while (tokens >> token)
+            {
+                job.args.push_back(token);
+            }
+
+            if (job.args.size() < 2 || job.args[1][0] == '#')
+            {
+                continue;
+            }
+
+            std::vector<const char*> argv;
+            for (const auto& arg : job.args)
+            {
+                argv.push_back(arg.c_str());
+            }
+            job.cmdl.add_params({"-o", "--output"});
+            job.cmdl.parse(static_cast<int>(argv.size()), argv.data(), cmdmode);
+
+            const std::string fallback = "batch_" + std::to_string(jobs.size()) + ".png";
+            job.cmdl({"-o", "--output"}, fallback) >> job.path;
+
+            jobs.push_back(std::move(job));
+        }
+
+        return true;
+    }
+
+    void run_lstgtufe_job(batch_job& job, const mesh_ptr& mesh, scheduler& sched)
+    {
+        lstgtufe_settings settings;
+        read_lstgtufe_settings(job.cmdl, settings);
+
+        const auto start = batch_clock::now();
+        auto heights = std::make_shared<terra::dynarray<tfloat>>(0);
+        profile prof;
+        std::string warm_start;
+        std::string save_state;
+        job.cmdl("--warm-start", "") >> warm_start;
+        job.cmdl("--save-state", "") >> save_state;
+        const size_t saved_from = lstgtufe_warm_start(sched, warm_start, *mesh, *heights);
+        job.itterations = lstgtufe_erode(sched, prof, *mesh, settings, *heights);
+        lstgtufe_save_state(save_state, *mesh, *heights, job.itterations, saved_from);
+        job.compute_time = seconds_since(start);
+
+        // the mesh and heights are owned by the write so this worker can
+        // move on to the next job while the image is encoded
+        job.write = sched.submit([&job, &sched, mesh, heights]()
+        {
+            const auto write_start = batch_clock::now();
+            if (!lstgtufe_write(sched, { job.path, output_type_of(job.path), read_image_settings(job.cmdl, job.path) }, *mesh, *heights))
+            {
+                throw std::runtime_error("unable to write the output");
+            }
+            job.write_time = seconds_since(write_start);
+        });
+    }
+
+    // Builds the group's mesh, then submits every job of the group. Jobs
+    // complete through their `computed` promise.
+    void run_mesh_group(const mesh_group& group, scheduler& sched)
+    {
+        const auto start = batch_clock::now();
+
+        mesh_ptr mesh;
+        try
+        {
+            mesh_storage storage;
+            storage.neighbours = group.neighbours;
+
+            profile prof;
+            mesh = std::make_shared<const lstgtufe_mesh>(sched, prof, group.key.width, group.key.height, group.key.radius, group.key.samples, storage);
+        }
+        catch (...)
+        {
+            for (auto* job : group.jobs)
+            {
+                job->computed.set_exception(std::current_exception());
+            }
+            return;
+        }
+
+        const double mesh_time = seconds_since(start);
+        for (size_t j = 0; j < group.jobs.size(); ++j)
+        {
+            auto& job = *group.jobs[j];
+            job.shared_mesh = j > 0;
+            job.mesh_time = j > 0 ? 0.0 : mesh_time;
+
+            sched.submit([&job, &sched, mesh]()
+            {
+                try
+                {
+                    run_lstgtufe_job(job, mesh, sched);
+                    job.computed.set_value();
+                }
+                catch (...)
+                {
+                    job.computed.set_exception(std::current_exception());
+                }
+            });
+        }
+    }
+
+    void run_noise_job(batch_job& job, scheduler& sched)
+    {
+        if (output_type_of(job.path) != output_type::heightfield)
+        {
+            throw std::runtime_error("noise only writes heightfields");
+        }
+
+        noise_settings settings;
+        if (!read_noise_settings(job.cmdl, 3, settings))
+        {
+            throw std::runtime_error("invalid noise settings");
+        }
+
+        const auto start = batch_clock::now();
+        auto noise_set = std::make_shared<terra::dynarray<tfloat>>(0);
+        if (!generate_noise(job.cmdl[2], settings, *noise_set))
+        {
+            throw std::runtime_error("unknown noise type \"" + job.cmdl[2] + "\"");
+        }
+        job.compute_time = seconds_since(start);
+
+        job.write = sched.submit([&job, &sched, settings, noise_set]()
+        {
+            const auto write_start = batch_clock::now();
+            if (!noise_write(sched, { job.path, output_type::heightfield, read_image_settings(job.cmdl, job.path) }, settings, *noise_set))
+            {
+                throw std::runtime_error("unable to write the output");
+            }
+            job.write_time = seconds_since(write_start);
+        });
+    }
+
+    std::string wait_for(std::future<void>& f)
+    {
+        if (!f.valid())
+        {
+            return "";
+        }
+
+        try
+        {
+            f.get();
+        }
+        catch (const std::exception& e)
+        {
+            return e.what();
+        }
+        catch (...)
+        {
+            return "unknown error";
+        }
+
+        return "";
+    }
+
+    void print_summary(std::vector<batch_job>& jobs, double wall_time)
+    {
+        std::cout << std::endl << "Batch summary" << std::endl;
+        std::cout << std::left
+                  << std::setw(6)  << "line"
+                  << std::setw(10) << "verb"
+                  << std::setw(10) << "mesh(s)"
+                  << std::setw(12) << "compute(s)"
+                  << std::setw(10) << "write(s)"
+                  << std::setw(8)  << "iters"
+                  << "output" << std::endl;
+
+        double job_time = 0.0;
+        size_t failed = 0;
+        for (auto& job : jobs)
+        {
+            std::string error = wait_for(job.compute);
+            if (error.empty())
+            {
+                error = wait_for(job.write);
+            }
+
+            std::ostringstream mesh;
+            mesh << std::fixed << std::setprecision(3) << job.mesh_time << (job.shared_mesh ? "*" : "");
+
+            std::cout << std::left << std::fixed << std::setprecision(3)
+                      << std::setw(6)  << job.line
+                      << std::setw(10) << job.cmdl[1]
+                      << std::setw(10) << mesh.str()
+                      << std::setw(12) << job.compute_time
+                      << std::setw(10) << job.write_time
+                      << std::setw(8)  << job.itterations
+                      << job.path;
+            if (!error.empty())
+            {
+                std::cout << " (failed: " << error << ")";
+                ++failed;
+            }
+            std::cout << std::endl;
+
+            job_time += job.mesh_time + job.compute_time + job.write_time;
+        }
+
+        std::cout << "* mesh shared with an earlier job" << std::endl;
+        std::cout << jobs.size() << " jobs (" << failed << " failed) in " << wall_time
+                  << "s wall time, " << job_time << "s job time" << std::endl;
+    }
+}
+
+bool configure_batch(const argh::parser& cmdl, const output&, scheduler& sched)
+{
+    const std::string manifest = cmdl[2];
+    if (manifest.empty())
+    {
+        return false;
+    }
+
+    std::vector<batch_job> jobs;
+    if (!read_manifest(manifest, jobs))
+    {
+        return false;
+    }
+
+    const auto start = batch_clock::now();
+
+    std::cout << "Running " << jobs.size() << " jobs on " << sched.size() << " threads" << std::endl;
+
+    // lstgtufe jobs are grouped by mesh, the groups keep manifest order.
+    // Writes are submitted as their own tasks so encoding overlaps with compute
+    std::vector<mesh_group> groups;
+    std::map<mesh_key, size_t> group_of;
+    for (auto& job : jobs)
+    {
+        const auto& verb = job.cmdl[1];
+        if (verb == "lstgtufe")
+        {
+            const auto option = unsupported_option(job.cmdl);
+            if (!option.empty())
+            {
+                job.compute = failed_job("unsupported option --" + option);
+                continue;
+            }
+
+            lstgtufe_settings settings;
+            read_lstgtufe_settings(job.cmdl, settings);
+            const auto key = make_key(settings);
+
+            const auto found = group_of.try_emplace(key, groups.size());
+            if (found.second)
+            {
+                groups.push_back({ key, {} });
+            }
+            groups[found.first->second].jobs.push_back(&job);
+            groups[found.first->second].neighbours |= settings.adaptive;
+
+            job.compute = job.computed.get_future();
+        }
+        else if (verb == "noise")
+        {
+            job.compute = sched.submit([&job, &sched]() { run_noise_job(job, sched); });
+        }
+        else
+        {
+            job.compute = failed_job("unsupported verb \"" + verb + "\"");
+        }
+    }
+
+    std::vector<std::future<void>> group_tasks;
+    for (const auto& group : groups)
+    {
+        group_tasks.push_back(sched.submit([&group, &sched]() { run_mesh_group(group, sched); }));
+    }
+
+    for (auto& task : group_tasks)
+    {
+        task.wait();
+    }
+    for (auto& job : jobs)
+    {
+        job.compute.wait();
+    }
+    for (auto& job : jobs)
+    {
+        if (job.write.valid())
+        {
+            job.write.wait();
+        }
+    }
+
+    print_summary(jobs, seconds_since(start));
+
+    return true;
+}
@@ -0,0 +1,446 @@
+#include "delaunay.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+    // below this many points the serial sweep beats the strips
+    const size_t min_strip_points = 1 << 16;
+
+    // the margin of points a strip sees beyond its own, in sampler radii.
+    // Interior circumdisks of a Poisson disc sampling are about a radius
+    // wide, the few larger ones along the hull are checked against every
+    // column they reach instead
+    const size_t margin_columns = 4;
+
+    // strips narrower than this many margins mostly triangulate their
+    // neighbours' points
+    const size_t min_strip_margins = 8;
+
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    struct circle_t
+    {
+        double x;
+        double y;
+        double r2;
+    };
+
+    // Circumcircle of the triangle, false when it is degenerate.
+    bool circumcircle(const terra::vec2& a, const terra::vec2& b, const terra::vec2& c, circle_t& circle)
+    {
+        const double bx = static_cast<double>(b.x) - a.x;
+        const double by = static_cast<double>(b.y) - a.y;
+        const double cx = static_cast<double>(c.x) - a.x;
+        const double cy = static_cast<double>(c.y) - a.y;
+
+        const double d = 2.0 * (bx * cy - by * cx);
+        if (d == 0.0)
+        {
+            return false;
+        }
+
+        const double b2 = bx * bx + by * by;
+        const double c2 = cx * cx + cy * cy;
+        const double ux = (cy * b2 - by * c2) / d;
+        const double uy = (bx * c2 - cx * b2) / d;
+        circle = { a.x + ux, a.y + uy, ux * ux + uy * uy };
+
+        return true;
+    }
+
+    // Positive when d lies inside the circle through a, b and c in
+    // counter clockwise order. Evaluated relative to d, so that it stays
+    // exact enough for the nearly straight triangles along the hull whose
+    // circumcentres are far away.
+    double in_circle(const terra::vec2& a, const terra::vec2& b, const terra::vec2& c, const terra::vec2& d)
+    {
+        const double adx = static_cast<double>(a.x) - d.x;
+        const double ady = static_cast<double>(a.y) - d.y;
+        const double bdx = static_cast<double>(b.x) - d.x;
+        const double bdy = static_cast<double>(b.y) - d.y;
+        const double cdx = static_cast<double>(c.x) - d.x;
+        const double cdy = static_cast<double>(c.y) - d.y;
+
+        return (adx * adx + ady * ady) * (bdx * cdy - cdx * bdy)
+             + (bdx * bdx + bdy * bdy) * (cdx * ady - adx * cdy)
+             + (cdx * cdx + cdy * cdy) * (adx * bdy - bdx * ady);
+    }
+
+    double cross(const terra::vec2& o, const terra::vec2& a, const terra::vec2& b)
+    {
+        return (static_cast<double>(a.x) - o.x) * (static_cast<double>(b.y) - o.y)
+             - (static_cast<double>(a.y) - o.y) * (static_cast<double>(b.x) - o.x);
+    }
+
+    // Replaces `points` with the corners of their convex hull, points on
+    // the hull between two corners are dropped.
+    void convex_hull(std::vector<terra::vec2>& points)
+    {
+        std::sort(points.begin(), points.end(), [](const terra::vec2& a, const terra::vec2& b)
+        {
+            return a.x < b.x || (a.x == b.x && a.y < b.y);
+        });
+        points.erase(std::unique(points.begin(), points.end(), [](const terra::vec2& a, const terra::vec2& b)
+        {
+            return a.x == b.x && a.y == b.y;
+        }), points.end());
+
+        if (points.size() < 3)
+        {
+            return;
+        }
+
+        std::vector<terra::vec2> hull(2 * points.size());
+        size_t k = 0;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0)
+            {
+                --k;
+            }
+            hull[k++] = points[i];
+        }
+        for (size_t i = points.size() - 1, lower = k + 1; i > 0; --i)
+        {
+            while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i - 1]) <= 0.0)
+            {
+                --k;
+            }
+            hull[k++] = points[i - 1];
+        }
+
+        hull.resize(k - 1);
+        points.swap(hull);
+    }
+
+    struct strip_t
+    {
+        // circumcentres the strip owns and the points it triangulates
+        double core_begin;
+        double core_end;
+        double seen_begin;
+        double seen_end;
+        size_t seen_first;
+        size_t seen_last;
+
+        // three global node indices per triangle
+        std::vector<uint32_t> kept;
+        std::vector<uint32_t> pending;
+
+        std::vector<terra::vec2> hull;
+    };
+
+    bool triangle_circle(const std::vector<terra::vec2>& points, const uint32_t* t, circle_t& circle)
+    {
+        // the same triangle found by two strips must give the same
+        // circumcentre, so it is always computed in index order
+        uint32_t v[3] = { t[0], t[1], t[2] };
+        std::sort(v, v + 3);
+
+        return circumcircle(points[v[0]], points[v[1]], points[v[2]], circle);
+    }
+}
+
+bool triangulate_strips(scheduler& sched,
+                        const std::vector<terra::vec2>& points,
+                        tfloat width,
+                        tfloat radius,
+                        terra::dynarray<terra::triangle>& tris,
+                        std::vector<uint32_t>* indices)
+{
+    const size_t node_count = points.size();
+    const size_t columns = static_cast<size_t>(std::max(0.0f, width / radius)) + 1;
+    const size_t strip_count = std::min(2 * sched.size(), columns / (margin_columns * min_strip_margins));
+    if (node_count < min_strip_points || strip_count < 2 || node_count > std::numeric_limits<uint32_t>::max())
+    {
+        return false;
+    }
+
+    // counting sort of the points into columns one radius wide
+    auto column_of = [&](const terra::vec2& p)
+    {
+        const tfloat c = std::floor(p.x / radius);
+        return static_cast<size_t>(std::clamp(c, 0.0f, static_cast<tfloat>(columns - 1)));
+    };
+
+    std::vector<uint32_t> column_offsets(columns + 1, 0);
+    for (const auto& p : points)
+    {
+        ++column_offsets[column_of(p) + 1];
+    }
+    for (size_t c = 1; c < column_offsets.size(); ++c)
+    {
+        column_offsets[c] += column_offsets[c - 1];
+    }
+
+    std::vector<uint32_t> by_column(node_count);
+    {
+        std::vector<uint32_t> fill(column_offsets.begin(), column_offsets.end() - 1);
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            by_column[fill[column_of(points[i])]++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // the outermost strips reach to infinity, as do the outermost columns
+    std::vector<strip_t> strips(strip_count);
+    auto column_edge = [&](size_t c)
+    {
+        return c == 0 ? -infinity : c >= columns ? infinity : static_cast<double>(c) * radius;
+    };
+
+    sched.parallel_for(0, strip_count, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t s = begin; s < end; ++s)
+        {
+            auto& strip = strips[s];
+
+            const size_t core_first = columns * s / strip_count;
+            const size_t core_last = columns * (s + 1) / strip_count;
+            const size_t seen_first = core_first > margin_columns ? core_first - margin_columns : 0;
+            const size_t seen_last = std::min(columns, core_last + margin_columns);
+
+            strip.core_begin = column_edge(core_first);
+            strip.core_end = column_edge(core_last);
+            strip.seen_begin = column_edge(seen_first);
+            strip.seen_end = column_edge(seen_last);
+            strip.seen_first = seen_first;
+            strip.seen_last = seen_last;
+
+            std::vector<uint32_t> global(by_column.begin() + column_offsets[seen_first], by_column.begin() + column_offsets[seen_last]);
+            std::vector<terra::vec2> local(global.size());
+            for (size_t i = 0; i < global.size(); ++i)
+            {
+                local[i] = points[global[i]];
+            }
+
+            for (uint32_t i = column_offsets[core_first]; i < column_offsets[core_last]; ++i)
+            {
+                strip.hull.push_back(points[by_column[i]]);
+            }
+            convex_hull(strip.hull);
+
+            terra::delaunator d;
+            const auto _tris = d.triangulate(local);
+            for (size_t t = 0; t + 2 < _tris.size(); t += 3)
+            {
+                const uint32_t v[3] =
+                {
+                    global[static_cast<size_t>(_tris[t])],
+                    global[static_cast<size_t>(_tris[t + 1])],
+                    global[static_cast<size_t>(_tris[t + 2])]
+                };
+
+                circle_t circle;
+                if (!triangle_circle(points, v, circle) || circle.x < strip.core_begin || circle.x >= strip.core_end)
+                {
+                    continue;
+                }
+
+                // every point in a disk that stays inside the strip was
+                // triangulated, so the strip already proved it empty
+                const double r = std::sqrt(circle.r2);
+                auto& target = circle.x - r >= strip.seen_begin && circle.x + r <= strip.seen_end ? strip.kept : strip.pending;
+                target.insert(target.end(), v, v + 3);
+            }
+        }
+    });
+
+    // with every column sorted by y a disk only has to look at the rows it
+    // covers within each column it reaches
+    sched.parallel_for(0, columns, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            std::sort(by_column.begin() + column_offsets[c], by_column.begin() + column_offsets[c + 1], [&](uint32_t a, uint32_t b)
+            {
+                return points[a].y < points[b].y;
+            });
+        }
+    });
+
+    auto is_empty = [&](const uint32_t* v, const circle_t& circle)
+    {
+        const auto& a = points[v[0]];
+        const auto& b = points[v[1]];
+        const auto& c = points[v[2]];
+        const double orientation = cross(a, b, c) > 0.0 ? 1.0 : -1.0;
+
+        // padded by a radius, the exact test is in_circle
+        const double r = std::sqrt(circle.r2) + radius;
+        const double first = std::clamp(std::floor((circle.x - r) / radius), 0.0, static_cast<double>(columns - 1));
+        const double last = std::clamp(std::floor((circle.x + r) / radius), 0.0, static_cast<double>(columns - 1));
+        for (size_t col = static_cast<size_t>(first); col <= static_cast<size_t>(last); ++col)
+        {
+            const double x0 = column_edge(col);
+            const double x1 = column_edge(col + 1);
+            const double dx = circle.x < x0 ? x0 - circle.x : circle.x > x1 ? circle.x - x1 : 0.0;
+            if (dx >= r)
+            {
+                continue;
+            }
+
+            const double h = std::sqrt(r * r - dx * dx);
+            const auto column_begin = by_column.begin() + column_offsets[col];
+            const auto column_end = by_column.begin() + column_offsets[col + 1];
+            auto it = std::lower_bound(column_begin, column_end, circle.y - h, [&](uint32_t i, double y)
+            {
+                return points[i].y < y;
+            });
+            for (; it != column_end && points[*it].y <= circle.y + h; ++it)
+            {
+                const uint32_t j = *it;
+                if (j != v[0] && j != v[1] && j != v[2] && orientation * in_circle(a, b, c, points[j]) > 0.0)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    };
+
+    sched.parallel_for(0, strip_count, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t s = begin; s < end; ++s)
+        {
+            auto& strip = strips[s];
+            for (size_t t = 0; t < strip.pending.size(); t += 3)
+            {
+                const uint32_t* v = strip.pending.data() + t;
+
+                circle_t circle;
+                if (triangle_circle(points, v, circle) && is_empty(v, circle))
+                {
+                    strip.kept.insert(strip.kept.end(), v, v + 3);
+                }
+            }
+        }
+    });
+
+    // Along the top and bottom of the domain the hull is nearly straight
+    // and its triangles can be longer than any strip is wide. Those are
+    // found by triangulating the points close to either end of every column
+    // and keeping the triangles no strip could have seen whole.
+    strip_t fringe = {};
+    {
+        std::vector<uint32_t> global;
+        for (size_t c = 0; c < columns; ++c)
+        {
+            const uint32_t first = column_offsets[c];
+            const uint32_t last = column_offsets[c + 1];
+            if (first == last)
+            {
+                continue;
+            }
+
+            const tfloat band = static_cast<tfloat>(margin_columns) * radius;
+            const tfloat low = points[by_column[first]].y + band;
+            const tfloat high = points[by_column[last - 1]].y - band;
+            for (uint32_t i = first; i < last; ++i)
+            {
+                const auto y = points[by_column[i]].y;
+                if (y <= low || y >= high)
+                {
+                    global.push_back(by_column[i]);
+                }
+            }
+        }
+
+        std::vector<terra::vec2> local(global.size());
+        for (size_t i = 0; i < global.size(); ++i)
+        {
+            local[i] = points[global[i]];
+        }
+
+        terra::delaunator d;
+        const auto _tris = d.triangulate(local);
+        for (size_t t = 0; t + 2 < _tris.size(); t += 3)
+        {
+            const uint32_t v[3] =
+            {
+                global[static_cast<size_t>(_tris[t])],
+                global[static_cast<size_t>(_tris[t + 1])],
+                global[static_cast<size_t>(_tris[t + 2])]
+            };
+
+            circle_t circle;
+            if (!triangle_circle(points, v, circle))
+            {
+                continue;
+            }
+
+            // a triangle of the whole set is found by the strip owning its
+            // circumcentre whenever that strip saw all three corners
+            const auto owner = std::find_if(strips.begin(), strips.end(), [&](const strip_t& strip)
+            {
+                return circle.x >= strip.core_begin && circle.x < strip.core_end;
+            });
+            const bool seen = owner != strips.end() && std::all_of(v, v + 3, [&](uint32_t i)
+            {
+                const size_t c = column_of(points[i]);
+                return c >= owner->seen_first && c < owner->seen_last;
+            });
+
+            if (!seen && is_empty(v, circle))
+            {
+                fringe.kept.insert(fringe.kept.end(), v, v + 3);
+            }
+        }
+    }
+    strips.push_back(std::move(fringe));
+
+    // a triangulation of n points with h of them on the hull has exactly
+    // 2n - 2 - h triangles, any other count means a strip missed some
+    std::vector<terra::vec2> hull;
+    size_t kept = 0;
+    for (const auto& strip : strips)
+    {
+        hull.insert(hull.end(), strip.hull.begin(), strip.hull.end());
+        kept += strip.kept.size() / 3;
+    }
+    convex_hull(hull);
+
+    const size_t expected = 2 * node_count - 2 - hull.size();
+    if (kept != expected)
+    {
+        std::cout << "Strip triangulation found " << kept << " of " << expected << " triangles, triangulating serially" << std::endl;
+        return false;
+    }
+
+    std::vector<size_t> offsets(strips.size() + 1, 0);
+    for (size_t s = 0; s < strips.size(); ++s)
+    {
+        offsets[s + 1] = offsets[s] + strips[s].kept.size() / 3;
+    }
+
+    // a strip's count is only known once its pending triangles are checked,
+    // so the kept triangles are copied out once, each strip at its offset
+    tris = terra::dynarray<terra::triangle>(kept);
+    if (indices)
+    {
+        indices->resize(3 * kept);
+    }
+    sched.parallel_for(0, strips.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t s = begin; s < end; ++s)
+        {
+            const auto& strip = strips[s];
+            if (indices)
+            {
+                std::copy(strip.kept.begin(), strip.kept.end(), indices->begin() + 3 * offsets[s]);
+            }
+            for (size_t t = 0; t < strip.kept.size() / 3; ++t)
+            {
+                const uint32_t* v = strip.kept.data() + 3 * t;
+                tris[offsets[s] + t] = terra::triangle(v[0], v[1], v[2]);
+            }
+        }
+    });
+
+    return true;
+}
@@ -0,0 +1,382 @@
+#include "density.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+
+#include "heightmap.hpp"
+#include "point_grid.hpp"
+#include "warm_start.hpp"
+
+namespace
+{
+    // raster cells along the longer side of the domain
+    const size_t density_resolution = 256;
+
+    // iterations of the coarse run behind --density presolve
+    const size_t presolve_itterations = 50;
+
+    const uint32_t sampler_seed = 2552;
+
+    // Turns raw source values into relief, the larger of the normalised
+    // value and the normalised slope of every cell.
+    void normalise_relief(density_field& field)
+    {
+        const auto [min, max] = std::minmax_element(field.values.begin(), field.values.end());
+        const tfloat low = *min;
+        const tfloat range = *max - *min;
+
+        const tfloat cell_x = field.width / static_cast<tfloat>(field.columns);
+        const tfloat cell_y = field.height / static_cast<tfloat>(field.rows);
+
+        std::vector<tfloat> slopes(field.values.size(), 0.0f);
+        tfloat max_slope = 0.0f;
+        for (size_t y = 0; y < field.rows; ++y)
+        {
+            for (size_t x = 0; x < field.columns; ++x)
+            {
+                const size_t x0 = x > 0 ? x - 1 : x;
+                const size_t x1 = std::min(field.columns - 1, x + 1);
+                const size_t y0 = y > 0 ? y - 1 : y;
+                const size_t y1 = std::min(field.rows - 1, y + 1);
+
+                const tfloat gx = x1 > x0 ? (field.values[y * field.columns + x1] - field.values[y * field.columns + x0]) / (static_cast<tfloat>(x1 - x0) * cell_x) : 0.0f;
+                const tfloat gy = y1 > y0 ? (field.values[y1 * field.columns + x] - field.values[y0 * field.columns + x]) / (static_cast<tfloat>(y1 - y0) * cell_y) : 0.0f;
+
+                slopes[y * field.columns + x] = std::sqrt(gx * gx + gy * gy);
+                max_slope = std::max(max_slope, slopes[y * field.columns + x]);
+            }
+        }
+
+        for (size_t i = 0; i < field.values.size(); ++i)
+        {
+            const tfloat value = range > 0.0f ? (field.values[i] - low) / range : 0.0f;
+            const tfloat slope = max_slope > 0.0f ? slopes[i] / max_slope : 0.0f;
+            field.values[i] = std::max(value, slope);
+        }
+    }
+
+    std::vector<terra::vec2> cell_centres(const density_field& field)
+    {
+        const tfloat cell_x = field.width / static_cast<tfloat>(field.columns);
+        const tfloat cell_y = field.height / static_cast<tfloat>(field.rows);
+
+        std::vector<terra::vec2> centres(field.columns * field.rows);
+        for (size_t y = 0; y < field.rows; ++y)
+        {
+            for (size_t x = 0; x < field.columns; ++x)
+            {
+                centres[y * field.columns + x] = { (static_cast<tfloat>(x) + 0.5f) * cell_x, (static_cast<tfloat>(y) + 0.5f) * cell_y };
+            }
+        }
+
+        return centres;
+    }
+
+    void uplift_source(const lstgtufe_settings& settings, density_field& field)
+    {
+        const auto centres = cell_centres(field);
+
+        terra::dynarray<tfloat> heights(centres.size());
+        std::fill(heights.begin(), heights.end(), 0.0f);
+        terra::linear_uplift uplift_func(settings.width, settings.height, 0.01, 1.0);
+        terra::uplift uplift(uplift_func, centres, heights, 1.0f);
+
+        field.values.assign(uplift.uplifts.begin(), uplift.uplifts.end());
+    }
+
+    void presolve_source(scheduler& sched, const lstgtufe_settings& settings, tfloat coarsen, density_field& field)
+    {
+        lstgtufe_settings coarse = settings;
+        coarse.radius = settings.radius * coarsen;
+        coarse.max_itterations = std::min(settings.max_itterations, presolve_itterations);
+        coarse.storage = {};
+        coarse.storage.neighbours = coarse.adaptive;
+
+        profile quiet;
+        const lstgtufe_mesh mesh(sched, quiet, coarse.width, coarse.height, coarse.radius, coarse.samples, coarse.storage);
+
+        terra::dynarray<tfloat> heights(0);
+        lstgtufe_erode(sched, quiet, mesh, coarse, heights);
+
+        const auto centres = cell_centres(field);
+        const point_grid grid(mesh.points, mesh.radius);
+        field.values.assign(centres.size(), 0.0f);
+        sched.parallel_for(0, centres.size(), 1024, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t nearest = grid.nearest(centres[i]);
+                field.values[i] = nearest == point_grid::npos ? 0.0f : heights[nearest];
+            }
+        });
+    }
+}
+
+tfloat density_field::at(const terra::vec2& p) const
+{
+    if (this->values.empty())
+    {
+        return 0.0f;
+    }
+
+    // cell centres sit at half cells, clamp to the outermost ones
+    const tfloat fx = std::clamp(p.x / this->width * static_cast<tfloat>(this->columns) - 0.5f, 0.0f, static_cast<tfloat>(this->columns - 1));
+    const tfloat fy = std::clamp(p.y / this->height * static_cast<tfloat>(this->rows) - 0.5f, 0.0f, static_cast<tfloat>(this->rows - 1));
+    const size_t x0 = static_cast<size_t>(fx);
+    const size_t y0 = static_cast<size_t>(fy);
+    const size_t x1 = std::min(this->columns - 1, x0 + 1);
+    const size_t y1 = std::min(this->rows - 1, y0 + 1);
+    const tfloat tx = fx - static_cast<tfloat>(x0);
+    const tfloat ty = fy - static_cast<tfloat>(y0);
+
+    const tfloat top = this->values[y0 * this->columns + x0] * (1.0f - tx) + this->values[y0 * this->columns + x1] * tx;
+    const tfloat bottom = this->values[y1 * this->columns + x0] * (1.0f - tx) + this->values[y1 * this->columns + x1] * tx;
+
+    return top * (1.0f - ty) + bottom * ty;
+}
+
+bool build_density(scheduler& sched,
+                   const argh::parser& cmdl,
+                   const lstgtufe_settings& settings,
+                   const std::string& source,
+                   tfloat coarsen,
+                   density_field& field)
+{
+    const size_t longest = std::max<size_t>(1, std::max(settings.width, settings.height));
+    field.columns = std::max<size_t>(2, density_resolution * settings.width / longest);
+    field.rows = std::max<size_t>(2, density_resolution * settings.height / longest);
+    field.width = static_cast<tfloat>(settings.width);
+    field.height = static_cast<tfloat>(settings.height);
+
+    if (source == "uplift")
+    {
+        uplift_source(settings, field);
+    }
+    else if (source == "presolve")
+    {
+        presolve_source(sched, settings, coarsen, field);
+    }
+    else if (source == "map")
+    {
+        heightmap map;
+        if (!load_heightmap(cmdl, field.columns, field.rows, map))
+        {
+            return false;
+        }
+        field.values.assign(map.values.begin(), map.values.end());
+    }
+    else
+    {
+        std::cout << "Unknown density source \"" << source << "\", expected uplift, presolve or map" << std::endl;
+        return false;
+    }
+
+    if (field.values.size() != field.columns * field.rows)
+    {
+        std::cout << "Density source \"" << source << "\" produced " << field.values.size() << " of "
+                  << field.columns * field.rows << " values" << std::endl;
+        return false;
+    }
+
+    normalise_relief(field);
+
+    return true;
+}
+
+std::vector<terra::vec2> sample_density(const density_field& field,
+                                        tfloat min_radius,
+                                        tfloat max_radius,
+                                        size_t samples,
+                                        std::vector<tfloat>& spacing,
+                                        profile& prof)
+{
+    profile::scope stage(prof, "sample points");
+
+    std::vector<terra::vec2> points;
+    spacing.clear();
+
+    auto radius_at = [&](const terra::vec2& p)
+    {
+        return max_radius - (max_radius - min_radius) * std::clamp(field.at(p), 0.0f, 1.0f);
+    };
+
+    // no two points are closer than min_radius, so a cell of this size
+    // holds at most one of them
+    const tfloat cell = min_radius / std::sqrt(2.0f);
+    const size_t columns = static_cast<size_t>(std::ceil(field.width / cell));
+    const size_t rows = static_cast<size_t>(std::ceil(field.height / cell));
+    std::vector<int32_t> grid(columns * rows, -1);
+
+    auto cell_of = [&](const terra::vec2& p)
+    {
+        const size_t x = std::min(columns - 1, static_cast<size_t>(p.x / cell));
+        const size_t y = std::min(rows - 1, static_cast<size_t>(p.y / cell));
+        return y * columns + x;
+    };
+
+    auto fits = [&](const terra::vec2& p, tfloat r)
+    {
+        // the farthest a conflicting point can be is the mean of r and the
+        // largest radius
+        const auto reach = static_cast<ptrdiff_t>(std::ceil(0.5f * (r + max_radius) / cell));
+        const auto cx = static_cast<ptrdiff_t>(std::min(columns - 1, static_cast<size_t>(p.x / cell)));
+        const auto cy = static_cast<ptrdiff_t>(std::min(rows - 1, static_cast<size_t>(p.y / cell)));
+
+        for (ptrdiff_t y = std::max<ptrdiff_t>(0, cy - reach); y <= std::min<ptrdiff_t>(static_cast<ptrdiff_t>(rows) - 1, cy + reach); ++y)
+        {
+            for (ptrdiff_t x = std::max<ptrdiff_t>(0, cx - reach); x <= std::min<ptrdiff_t>(static_cast<ptrdiff_t>(columns) - 1, cx + reach); ++x)
+            {
+                const int32_t i = grid[static_cast<size_t>(y) * columns + static_cast<size_t>(x)];
+                if (i < 0)
+                {
+                    continue;
+                }
+
+                const tfloat dx = points[i].x - p.x;
+                const tfloat dy = points[i].y - p.y;
+                const tfloat d = 0.5f * (r + spacing[i]);
+                if (dx * dx + dy * dy < d * d)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    };
+
+    auto add = [&](const terra::vec2& p, tfloat r)
+    {
+        grid[cell_of(p)] = static_cast<int32_t>(points.size());
+        points.push_back(p);
+        spacing.push_back(r);
+    };
+
+    std::mt19937 rng(sampler_seed);
+    std::uniform_real_distribution<tfloat> unit(0.0f, 1.0f);
+
+    const terra::vec2 first = { unit(rng) * field.width, unit(rng) * field.height };
+    add(first, radius_at(first));
+
+    std::vector<uint32_t> active = { 0 };
+    while (!active.empty())
+    {
+        const size_t a = static_cast<size_t>(unit(rng) * static_cast<tfloat>(active.size())) % active.size();
+        const terra::vec2 p = points[active[a]];
+        const tfloat r = spacing[active[a]];
+
+        bool found = false;
+        for (size_t k = 0; k < samples && !found; ++k)
+        {
+            const tfloat angle = unit(rng) * 2.0f * terra::math::PI;
+            const tfloat step = 1.0f + unit(rng);
+            auto candidate = [&](tfloat mean)
+            {
+                const tfloat distance = mean * step;
+                return terra::vec2{ p.x + distance * std::cos(angle), p.y + distance * std::sin(angle) };
+            };
+
+            // candidates fall in the annulus of the mean of both radii, which
+            // is the spacing fits() asks for. r .. 2r alone leaves gaps where
+            // coarse points sit next to fine ground. The candidate's radius
+            // is estimated from a first draw at r and the draw repeated.
+            terra::vec2 c = candidate(r);
+            c = candidate(0.5f * (r + radius_at(c)));
+            if (c.x < 0.0f || c.y < 0.0f || c.x >= field.width || c.y >= field.height)
+            {
+                continue;
+            }
+
+            const tfloat rc = radius_at(c);
+            if (fits(c, rc))
+            {
+                active.push_back(static_cast<uint32_t>(points.size()));
+                add(c, rc);
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            active[a] = active.back();
+            active.pop_back();
+        }
+    }
+
+    stage.set_nodes(points.size());
+    std::cout << "Points sampled: " << points.size() << std::endl;
+
+    return points;
+}
+
+bool lstgtufe_density(const argh::parser& cmdl,
+                      const output& out,
+                      scheduler& sched,
+                      const lstgtufe_settings& settings,
+                      const std::string& source)
+{
+    // the mesh is built over the sampled points as they are, on the heap
+    if (!settings.storage.directory.empty())
+    {
+        std::cout << "Density sampled runs do not support --storage" << std::endl;
+        return false;
+    }
+    if (settings.storage.reorder)
+    {
+        std::cout << "Density sampled runs do not support --reorder" << std::endl;
+        return false;
+    }
+
+    tfloat coarsen = 4.0f;
+    cmdl("--coarsen", coarsen) >> coarsen;
+    coarsen = std::max(1.0f, coarsen);
+
+    std::string warm_start;
+    std::string save_state;
+    cmdl("--warm-start", "") >> warm_start;
+    cmdl("--save-state", "") >> save_state;
+
+    density_field field;
+    if (!build_density(sched, cmdl, settings, source, coarsen, field))
+    {
+        return false;
+    }
+
+    const bool perf = cmdl["perf"] || cmdl("perf");
+    profile prof(perf || cmdl["profile"] || cmdl("profile"), perf);
+
+    std::vector<tfloat> spacing;
+    auto points = sample_density(field, settings.radius, settings.radius * coarsen, settings.samples, spacing, prof);
+
+    // every point stands for an area proportional to its radius squared
+    double uniform = 0.0;
+    for (const auto r : spacing)
+    {
+        uniform += static_cast<double>(r) * r / (static_cast<double>(settings.radius) * settings.radius);
+    }
+    std::cout << "Sampling everything at radius " << settings.radius << " would take about "
+              << static_cast<size_t>(uniform) << " points, "
+              << uniform / static_cast<double>(std::max<size_t>(1, points.size())) << "x as many" << std::endl;
+
+    const lstgtufe_mesh mesh(sched, prof, settings.width, settings.height, settings.radius, std::move(points), std::move(spacing), settings.storage);
+
+    // the sampler is seeded, so a state saved with the same options and
+    // source is copied rather than interpolated
+    terra::dynarray<tfloat> heights(0);
+    const size_t saved_from = lstgtufe_warm_start(sched, warm_start, mesh, heights);
+    const size_t itterations = lstgtufe_erode(sched, prof, mesh, settings, heights);
+    lstgtufe_save_state(save_state, mesh, heights, itterations, saved_from);
+
+    {
+        profile::scope stage(prof, "write");
+        stage.set_nodes(mesh.points.size());
+        lstgtufe_write(sched, out, mesh, heights);
+    }
+
+    prof.print(std::cout);
+
+    return true;
+}
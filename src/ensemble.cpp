@@ -0,0 +1,168 @@
+#include "ensemble.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+    std::string member_path(const std::string& path, size_t member)
+    {
+        const std::filesystem::path p(path);
+        auto name = p.stem().string() + "_" + std::to_string(member) + p.extension().string();
+
+        return (p.parent_path() / name).string();
+    }
+}
+
+bool read_ensemble_members(const std::string& path, std::vector<ensemble_member>& members)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "Unable to open ensemble: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line))
+    {
+        ++line_number;
+
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first) || first[0] == '#')
+        {
+            continue;
+        }
+
+        ensemble_member member;
+        fields.clear();
+        fields.str(line);
+        if (!(fields >> member.uplift_per_year >> member.erosion_rate >> member.time_scale))
+        {
+            std::cout << "Ensemble line " << line_number << " needs uplift_per_year erosion_rate time_scale" << std::endl;
+            return false;
+        }
+        fields >> member.max_itterations;
+
+        members.push_back(member);
+    }
+
+    return !members.empty();
+}
+
+std::vector<size_t> lstgtufe_ensemble_erode(scheduler& sched,
+                                            profile& prof,
+                                            const lstgtufe_mesh& mesh,
+                                            const lstgtufe_settings& settings,
+                                            const std::vector<ensemble_member>& members,
+                                            std::vector<terra::dynarray<tfloat>>& heights)
+{
+    heights.assign(members.size(), terra::dynarray<tfloat>(0));
+    std::vector<size_t> itterations(members.size(), 0);
+    std::vector<std::ostringstream> logs(members.size());
+
+    profile::scope stage(prof, "ensemble erosion");
+    stage.set_nodes(mesh.points.size() * members.size());
+
+    // members only read the mesh, so each is a task with its own solvers.
+    // Their stages are not profiled one by one and their reports are printed
+    // in member order once all of them are done
+    std::vector<std::future<void>> tasks;
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        tasks.push_back(sched.submit([&, m]()
+        {
+            lstgtufe_settings member = settings;
+            member.uplift_per_year = members[m].uplift_per_year;
+            member.erosion_rate = members[m].erosion_rate;
+            member.time_scale = members[m].time_scale;
+            member.max_itterations = members[m].max_itterations;
+
+            profile quiet;
+            itterations[m] = lstgtufe_erode(sched, quiet, mesh, member, heights[m], logs[m]);
+        }));
+    }
+
+    for (auto& task : tasks)
+    {
+        task.wait();
+    }
+
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        tasks[m].get();
+
+        std::cout << logs[m].str() << "Member " << m << " converged in " << itterations[m] << " iterations" << std::endl;
+    }
+
+    return itterations;
+}
+
+bool lstgtufe_ensemble(const argh::parser& cmdl,
+                       const output& out,
+                       scheduler& sched,
+                       const lstgtufe_settings& settings,
+                       const std::string& members_path)
+{
+    // a state holds one height field, an ensemble has one per member, and
+    // the members share a mesh sampled at a single radius
+    for (const auto* param : { "density", "warm-start", "save-state" })
+    {
+        if (cmdl(param))
+        {
+            std::cout << "Ensemble runs do not support --" << param << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<ensemble_member> members;
+    if (!read_ensemble_members(members_path, members))
+    {
+        return false;
+    }
+
+    const bool perf = cmdl["perf"] || cmdl("perf");
+    profile prof(perf || cmdl["profile"] || cmdl("profile"), perf);
+    const lstgtufe_mesh mesh(sched, prof, settings.width, settings.height, settings.radius, settings.samples, settings.storage);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<terra::dynarray<tfloat>> heights;
+    const auto itterations = lstgtufe_ensemble_erode(sched, prof, mesh, settings, members, heights);
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::endl << "Ensemble of " << members.size() << " members in " << elapsed.count() << "s" << std::endl;
+    std::cout << std::left
+              << std::setw(8)  << "member"
+              << std::setw(14) << "uplift"
+              << std::setw(14) << "erosion"
+              << std::setw(14) << "time_scale"
+              << std::setw(8)  << "iters"
+              << "output" << std::endl;
+
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        const std::string path = member_path(out.path, m);
+        const bool written = lstgtufe_write(sched, { path, out.type, out.image }, mesh, heights[m]);
+
+        std::cout << std::left
+                  << std::setw(8)  << m
+                  << std::setw(14) << members[m].uplift_per_year
+                  << std::setw(14) << members[m].erosion_rate
+                  << std::setw(14) << members[m].time_scale
+                  << std::setw(8)  << itterations[m]
+                  << path << (written ? "" : " (failed)") << std::endl;
+    }
+
+    prof.print(std::cout);
+
+    return true;
+}
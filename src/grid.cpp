@@ -0,0 +1,44 @@
+#include "grid.hpp"
+
+#include <algorithm>
+
+void copy_to_grid(const heightmap& map, const grid_layout& layout, grid_buffer& buffer)
+{
+    buffer.resize(layout.cells());
+    for (size_t y = 0; y < layout.rows; ++y)
+    {
+        const size_t src_y = std::clamp<size_t>(y, 1, layout.height) - 1;
+        const auto row = map.values.begin() + src_y * layout.width;
+        const size_t dst = y * layout.stride;
+
+        std::copy(row, row + layout.width, buffer.begin() + dst + 1);
+        buffer[dst] = row[0];
+        buffer[dst + layout.stride - 1] = row[layout.width - 1];
+    }
+}
+
+void copy_from_grid(const grid_buffer& buffer, const grid_layout& layout, heightmap& map)
+{
+    map.width = layout.width;
+    map.height = layout.height;
+    map.values.resize(layout.width * layout.height);
+    for (size_t y = 0; y < layout.height; ++y)
+    {
+        const auto row = buffer.begin() + layout.index(0, y);
+        std::copy(row, row + layout.width, map.values.begin() + y * layout.width);
+    }
+}
+
+void run_row_tiled(scheduler& sched, size_t rows, size_t steps, size_t phases, const row_kernel_t& kernel)
+{
+    for (size_t step = 0; step < steps; ++step)
+    {
+        for (size_t phase = 0; phase < phases; ++phase)
+        {
+            sched.parallel_for(0, rows, 1, [&](size_t row_begin, size_t row_end)
+            {
+                kernel(phase, row_begin, row_end);
+            });
+        }
+    }
+}
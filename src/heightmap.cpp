@@ -0,0 +1,131 @@
+#include "heightmap.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "noise.hpp"
+#include "png_writer.hpp"
+
+bool load_heightmap(const argh::parser& cmdl, size_t width, size_t height, heightmap& map)
+{
+    std::string input_path;
+    std::string noise_type;
+    cmdl({"-i", "--input"}, "") >> input_path;
+    cmdl("--noise", "fBm") >> noise_type;
+
+    if (width == 0 || height == 0)
+    {
+        std::cout << "Heightmap must be at least 1x1, not " << width << "x" << height << std::endl;
+        return false;
+    }
+
+    if (!input_path.empty())
+    {
+        return read_heightmap_raw(input_path, width, height, map);
+    }
+
+    noise_settings settings;
+    settings.x_size = width;
+    settings.y_size = height;
+    cmdl("--seed", settings.seed) >> settings.seed;
+    cmdl("--octaves", settings.octaves) >> settings.octaves;
+    cmdl("--scale", settings.scale) >> settings.scale;
+
+    terra::dynarray<tfloat> noise_set(0);
+    if (!generate_noise(noise_type, settings, noise_set) || noise_set.size() != width * height)
+    {
+        std::cout << "Unable to generate \"" << noise_type << "\" noise input" << std::endl;
+        return false;
+    }
+
+    map.width = width;
+    map.height = height;
+    map.values.assign(noise_set.begin(), noise_set.end());
+
+    return true;
+}
+
+bool read_heightmap_raw(const std::string& path, size_t width, size_t height, heightmap& map)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Unable to open heightmap: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<float> raw(width * height);
+    file.read(reinterpret_cast<char*>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(float)));
+    if (static_cast<size_t>(file.gcount()) != raw.size() * sizeof(float))
+    {
+        std::cout << "Heightmap \"" << path << "\" is smaller than " << width << "x" << height << std::endl;
+        return false;
+    }
+
+    map.width = width;
+    map.height = height;
+    map.values.assign(raw.begin(), raw.end());
+
+    return true;
+}
+
+bool write_heightmap(scheduler& sched, const output& out, const heightmap& map)
+{
+    const size_t node_count = map.width * map.height;
+
+    switch (out.type)
+    {
+        case output_type::heightfield:
+        {
+            const auto [min, max] = std::minmax_element(map.values.begin(), map.values.end());
+
+            if (out.image.format == image_format::png)
+            {
+                return write_png(sched, out.path, map.width, map.height, map.values.data(), *min, *max, out.image);
+            }
+
+            terra::dynarray<tfloat> values(node_count);
+            std::copy(map.values.begin(), map.values.end(), values.begin());
+
+            terra::heightfield h;
+            auto bitmap = h.raster<float>(map.width, map.height, *min, *max, values);
+
+            terra::io::write_image(out.path, bitmap);
+            break;
+        }
+        case output_type::model:
+        {
+            terra::dynarray<terra::vec3> verts(node_count);
+            sched.parallel_for(0, map.height, 1, [&](size_t begin, size_t end)
+            {
+                for (size_t y = begin; y < end; ++y)
+                {
+                    for (size_t x = 0; x < map.width; ++x)
+                    {
+                        const size_t i = y * map.width + x;
+                        verts[i] = { static_cast<tfloat>(x), static_cast<tfloat>(y), map.values[i] };
+                    }
+                }
+            });
+
+            const size_t quads = map.width > 1 && map.height > 1 ? (map.width - 1) * (map.height - 1) : 0;
+            terra::dynarray<terra::triangle> tris(2 * quads);
+            size_t t = 0;
+            for (size_t y = 0; y + 1 < map.height; ++y)
+            {
+                for (size_t x = 0; x + 1 < map.width; ++x)
+                {
+                    const size_t i = y * map.width + x;
+                    tris[t++] = terra::triangle(i, i + map.width, i + 1);
+                    tris[t++] = terra::triangle(i + 1, i + map.width, i + map.width + 1);
+                }
+            }
+
+            terra::io::obj::write_obj(out.path, verts, tris);
+            break;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,309 @@
+#include "simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "grid.hpp"
+
+namespace
+{
+    const tfloat flux_epsilon = 1e-6f;
+
+    // steps between progress reports
+    const size_t report_steps = 50;
+
+    enum pipe_phase : size_t
+    {
+        outflow_flux,
+        water_velocity,
+        erosion_deposition,
+        sediment_transport,
+        evaporation,
+        pipe_phase_count
+    };
+
+    struct pipe_model
+    {
+        explicit pipe_model(const heightmap& map) : layout(map.width, map.height)
+        {
+            copy_to_grid(map, layout, terrain);
+
+            const size_t cells = layout.cells();
+            water.assign(cells, 0.0f);
+            sediment.assign(cells, 0.0f);
+            sediment_next.assign(cells, 0.0f);
+            flux_l.assign(cells, 0.0f);
+            flux_r.assign(cells, 0.0f);
+            flux_t.assign(cells, 0.0f);
+            flux_b.assign(cells, 0.0f);
+            velocity_u.assign(cells, 0.0f);
+            velocity_v.assign(cells, 0.0f);
+            capacity.assign(cells, 0.0f);
+        }
+
+        grid_layout layout;
+
+        grid_buffer terrain;
+        grid_buffer water;
+        grid_buffer sediment;
+        grid_buffer sediment_next;
+        grid_buffer flux_l;
+        grid_buffer flux_r;
+        grid_buffer flux_t;
+        grid_buffer flux_b;
+        grid_buffer velocity_u;
+        grid_buffer velocity_v;
+        grid_buffer capacity;
+    };
+
+    // row kernels take their buffers as restrict parameters so that the
+    // compiler can vectorise them without runtime alias checks
+    void flux_row(const tfloat* __restrict b,
+                  const tfloat* __restrict d,
+                  tfloat* __restrict fl,
+                  tfloat* __restrict fr,
+                  tfloat* __restrict ft,
+                  tfloat* __restrict fb,
+                  size_t count,
+                  size_t stride,
+                  const hydraulic_settings& s)
+    {
+        const tfloat rain = s.rain * s.dt;
+        const tfloat pipe = s.dt * s.pipe_area * s.gravity / s.cell_size;
+        const tfloat cell_area = s.cell_size * s.cell_size;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            // rain falls evenly so it cancels out of the height differences
+            const tfloat surface = b[i] + d[i];
+            const tfloat l = std::max(0.0f, fl[i] + pipe * (surface - b[i - 1] - d[i - 1]));
+            const tfloat r = std::max(0.0f, fr[i] + pipe * (surface - b[i + 1] - d[i + 1]));
+            const tfloat t = std::max(0.0f, ft[i] + pipe * (surface - b[i - stride] - d[i - stride]));
+            const tfloat o = std::max(0.0f, fb[i] + pipe * (surface - b[i + stride] - d[i + stride]));
+
+            // scale the outflow so a cell never loses more water than it holds
+            const tfloat total = (l + r + t + o) * s.dt;
+            const tfloat k = std::min(1.0f, (d[i] + rain) * cell_area / std::max(total, flux_epsilon));
+
+            fl[i] = l * k;
+            fr[i] = r * k;
+            ft[i] = t * k;
+            fb[i] = o * k;
+        }
+    }
+
+    void water_row(const tfloat* __restrict b,
+                   const tfloat* __restrict fl,
+                   const tfloat* __restrict fr,
+                   const tfloat* __restrict ft,
+                   const tfloat* __restrict fb,
+                   tfloat* __restrict d,
+                   tfloat* __restrict u,
+                   tfloat* __restrict v,
+                   tfloat* __restrict c,
+                   size_t count,
+                   size_t stride,
+                   const hydraulic_settings& s)
+    {
+        const tfloat rain = s.rain * s.dt;
+        const tfloat inv_area = 1.0f / (s.cell_size * s.cell_size);
+        const tfloat inv_2l = 0.5f / s.cell_size;
+        const tfloat inv_depth = 1.0f / s.max_depth;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const tfloat inflow = fr[i - 1] + fl[i + 1] + fb[i - stride] + ft[i + stride];
+            const tfloat outflow = fl[i] + fr[i] + ft[i] + fb[i];
+
+            const tfloat d1 = d[i] + rain;
+            const tfloat d2 = std::max(0.0f, d1 + s.dt * (inflow - outflow) * inv_area);
+
+            const tfloat dwx = 0.5f * (fr[i - 1] - fl[i] + fr[i] - fl[i + 1]);
+            const tfloat dwy = 0.5f * (fb[i - stride] - ft[i] + fb[i] - ft[i + stride]);
+            const tfloat depth = std::max(0.5f * (d1 + d2), flux_epsilon) * s.cell_size;
+
+            const tfloat vx = dwx / depth;
+            const tfloat vy = dwy / depth;
+
+            const tfloat gx = (b[i + 1] - b[i - 1]) * inv_2l;
+            const tfloat gy = (b[i + stride] - b[i - stride]) * inv_2l;
+            const tfloat g2 = gx * gx + gy * gy;
+            const tfloat sin_tilt = std::max(s.min_tilt, std::sqrt(g2 / (1.0f + g2)));
+
+            // shallow water carries less, which keeps the film left by rain from cutting channels
+            const tfloat depth_limit = std::min(1.0f, d2 * inv_depth);
+
+            d[i] = d2;
+            u[i] = vx;
+            v[i] = vy;
+            c[i] = s.capacity * sin_tilt * depth_limit * std::sqrt(vx * vx + vy * vy);
+        }
+    }
+
+    void erosion_row(const tfloat* __restrict c,
+                     tfloat* __restrict b,
+                     tfloat* __restrict sd,
+                     size_t count,
+                     const hydraulic_settings& s)
+    {
+        const tfloat dissolve = s.dissolve * s.dt;
+        const tfloat deposit = s.deposit * s.dt;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const tfloat diff = c[i] - sd[i];
+            const tfloat rate = diff > 0.0f ? dissolve : deposit;
+            const tfloat amount = std::max(rate * diff, -sd[i]);
+
+            b[i] -= amount;
+            sd[i] += amount;
+        }
+    }
+
+    void evaporation_row(const tfloat* __restrict next,
+                         tfloat* __restrict sd,
+                         tfloat* __restrict d,
+                         size_t count,
+                         tfloat keep)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            sd[i] = next[i];
+            d[i] *= keep;
+        }
+    }
+
+    void update_flux(pipe_model& m, const hydraulic_settings& s, size_t row_begin, size_t row_end)
+    {
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            const size_t i = m.layout.index(0, y);
+            flux_row(&m.terrain[i],
+                     &m.water[i],
+                     &m.flux_l[i],
+                     &m.flux_r[i],
+                     &m.flux_t[i],
+                     &m.flux_b[i],
+                     m.layout.width,
+                     m.layout.stride,
+                     s);
+        }
+    }
+
+    void update_water(pipe_model& m, const hydraulic_settings& s, size_t row_begin, size_t row_end)
+    {
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            const size_t i = m.layout.index(0, y);
+            water_row(&m.terrain[i],
+                      &m.flux_l[i],
+                      &m.flux_r[i],
+                      &m.flux_t[i],
+                      &m.flux_b[i],
+                      &m.water[i],
+                      &m.velocity_u[i],
+                      &m.velocity_v[i],
+                      &m.capacity[i],
+                      m.layout.width,
+                      m.layout.stride,
+                      s);
+        }
+    }
+
+    void erode_deposit(pipe_model& m, const hydraulic_settings& s, size_t row_begin, size_t row_end)
+    {
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            const size_t i = m.layout.index(0, y);
+            erosion_row(&m.capacity[i], &m.terrain[i], &m.sediment[i], m.layout.width, s);
+        }
+    }
+
+    void transport_sediment(pipe_model& m, const hydraulic_settings& s, size_t row_begin, size_t row_end)
+    {
+        const tfloat* u = m.velocity_u.data();
+        const tfloat* v = m.velocity_v.data();
+        const tfloat* sd = m.sediment.data();
+        tfloat* next = m.sediment_next.data();
+
+        const grid_layout& layout = m.layout;
+        const tfloat step = s.dt / s.cell_size;
+        const tfloat max_x = static_cast<tfloat>(layout.width - 1);
+        const tfloat max_y = static_cast<tfloat>(layout.height - 1);
+
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            for (size_t x = 0; x < layout.width; ++x)
+            {
+                const size_t i = layout.index(x, y);
+
+                // semi-Lagrangian step, trace the velocity back and sample
+                const tfloat px = std::clamp(static_cast<tfloat>(x) - u[i] * step, 0.0f, max_x);
+                const tfloat py = std::clamp(static_cast<tfloat>(y) - v[i] * step, 0.0f, max_y);
+
+                const size_t x0 = static_cast<size_t>(px);
+                const size_t y0 = static_cast<size_t>(py);
+                const tfloat fx = px - static_cast<tfloat>(x0);
+                const tfloat fy = py - static_cast<tfloat>(y0);
+
+                // the ghost border keeps x0 + 1 and y0 + 1 in range
+                const size_t j = layout.index(x0, y0);
+                const tfloat top = sd[j] + fx * (sd[j + 1] - sd[j]);
+                const tfloat bottom = sd[j + layout.stride] + fx * (sd[j + layout.stride + 1] - sd[j + layout.stride]);
+
+                next[i] = top + fy * (bottom - top);
+            }
+        }
+    }
+
+    void evaporate(pipe_model& m, const hydraulic_settings& s, size_t row_begin, size_t row_end)
+    {
+        const tfloat keep = std::max(0.0f, 1.0f - s.evaporation * s.dt);
+
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            const size_t i = m.layout.index(0, y);
+            evaporation_row(&m.sediment_next[i], &m.sediment[i], &m.water[i], m.layout.width, keep);
+        }
+    }
+}
+
+void hydraulic_erosion(scheduler& sched, const output& out, heightmap& map, const hydraulic_settings& settings)
+{
+    pipe_model model(map);
+
+    auto kernel = [&](size_t phase, size_t row_begin, size_t row_end)
+    {
+        switch (phase)
+        {
+            case outflow_flux:          update_flux(model, settings, row_begin, row_end); break;
+            case water_velocity:        update_water(model, settings, row_begin, row_end); break;
+            case erosion_deposition:    erode_deposit(model, settings, row_begin, row_end); break;
+            case sediment_transport:    transport_sediment(model, settings, row_begin, row_end); break;
+            case evaporation:           evaporate(model, settings, row_begin, row_end); break;
+        }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < settings.steps; done += report_steps)
+    {
+        const size_t steps = std::min(report_steps, settings.steps - done);
+        run_row_tiled(sched, map.height, steps, pipe_phase_count, kernel);
+
+        std::cout << "Hydraulic erosion: " << (done + steps) << "/" << settings.steps << " steps" << std::endl;
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Hydraulic erosion completed in " << elapsed.count() << "s" << std::endl;
+
+    // deposit the sediment still in suspension so no material is lost
+    for (size_t i = 0; i < model.terrain.size(); ++i)
+    {
+        model.terrain[i] += model.sediment[i];
+    }
+
+    copy_from_grid(model.terrain, model.layout, map);
+    write_heightmap(sched, out, map);
+}
@@ -1,63 +1,466 @@
 #include "lstgtufe.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 
 #include <terra/terra.hpp>
 
-tfloat terrain_epsilon = 0.0001;
+#include "arena.hpp"
+#include "delaunay.hpp"
+#include "density.hpp"
+#include "ensemble.hpp"
+#include "png_writer.hpp"
+#include "point_grid.hpp"
+#include "shard.hpp"
+#include "warm_start.hpp"
 
-inline bool end_function(const terra::dynarray<tfloat>& heights,
-                         const terra::dynarray<tfloat>& heights_old)
+namespace
 {
-    for (size_t i = 0; i < heights.size(); ++i)
+    // grain for loops over the nodes of the mesh
+    const size_t node_grain = 16384;
+
+    inline bool end_function(scheduler& sched,
+                             const terra::dynarray<tfloat>& heights,
+                             const std::pmr::vector<tfloat>& heights_old,
+                             std::pmr::memory_resource* scratch)
+    {
+        return sched.parallel_reduce(0, heights.size(), node_grain, false,
+            [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    if (terra::math::abs(heights[i] - heights_old[i]) > terrain_epsilon)
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            },
+            [](bool a, bool b) { return a || b; },
+            scratch);
+    }
+
+    std::vector<terra::vec2> sample_points(size_t width,
+                                           size_t height,
+                                           float radius,
+                                           size_t samples,
+                                           std::unique_ptr<terra::hash_grid>& hash_grid,
+                                           profile& prof)
+    {
+        profile::scope stage(prof, "sample points");
+
+        terra::hash_grid* temp_grid = nullptr;
+        auto sampler = terra::poisson_disc_sampler();
+        auto points = sampler.sample(width, height, radius, samples, &temp_grid);
+
+        hash_grid = std::unique_ptr<terra::hash_grid>(temp_grid);
+
+        std::cout << "Points sampled: " << points.size() << std::endl;
+        stage.set_nodes(points.size());
+
+        return points;
+    }
+
+    // Position of (x, y) along a Hilbert curve over a 2^16 by 2^16 grid.
+    uint64_t hilbert_index(uint32_t x, uint32_t y)
+    {
+        uint64_t d = 0;
+        for (uint32_t s = 1u << 15; s > 0; s >>= 1)
+        {
+            const uint32_t rx = (x & s) > 0;
+            const uint32_t ry = (y & s) > 0;
+            d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+
+        return d;
+    }
+
+    // Sorts the points along a Hilbert curve. Every array indexed by node then
+    // keeps neighbouring nodes on the same cache lines and pages.
+    void reorder_points(std::vector<terra::vec2>& points, size_t width, size_t height, profile& prof)
+    {
+        profile::scope stage(prof, "reorder");
+        stage.set_nodes(points.size());
+
+        const tfloat scale_x = 65535.0f / static_cast<tfloat>(std::max<size_t>(width, 1));
+        const tfloat scale_y = 65535.0f / static_cast<tfloat>(std::max<size_t>(height, 1));
+
+        std::vector<std::pair<uint64_t, uint32_t>> keys(points.size());
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            const auto x = static_cast<uint32_t>(std::clamp(points[i].x * scale_x, 0.0f, 65535.0f));
+            const auto y = static_cast<uint32_t>(std::clamp(points[i].y * scale_y, 0.0f, 65535.0f));
+            keys[i] = { hilbert_index(x, y), static_cast<uint32_t>(i) };
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<terra::vec2> sorted(points.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            sorted[i] = points[keys[i].second];
+        }
+        points.swap(sorted);
+    }
+
+    // `pattern` is how the buffers placed in the arena will be walked
+    std::unique_ptr<arena> make_storage(const mesh_storage& storage, access_pattern pattern)
     {
-        if (terra::math::abs(heights[i] - heights_old[i]) > terrain_epsilon)
+        if (storage.directory.empty())
         {
-            return true;
+            return nullptr;
         }
+
+        auto backing = std::make_unique<arena>(64 << 20, storage.directory);
+        backing->advise(pattern);
+
+        return backing;
     }
 
-    return false;
+    std::pmr::memory_resource* storage_resource(const std::unique_ptr<arena>& storage)
+    {
+        return storage ? storage.get() : std::pmr::get_default_resource();
+    }
+
+    // Every triangle contributes both directions of its three edges, edges
+    // shared by two triangles are deduplicated per row. The edge list is
+    // allocated from `scratch`.
+    template<typename indices_t>
+    void build_adjacency(size_t node_count, const indices_t& _tris, mesh_adjacency& adjacency, std::pmr::memory_resource* scratch)
+    {
+        std::pmr::vector<uint32_t> counts(node_count + 1, 0, scratch);
+        for (size_t i = 0; i < _tris.size(); ++i)
+        {
+            counts[_tris[i] + 1] += 2;
+        }
+        for (size_t i = 1; i < counts.size(); ++i)
+        {
+            counts[i] += counts[i - 1];
+        }
+
+        std::pmr::vector<uint32_t> edges(counts.back(), scratch);
+        std::pmr::vector<uint32_t> fill(counts.begin(), counts.end() - 1, scratch);
+        for (size_t t = 0; t + 2 < _tris.size(); t += 3)
+        {
+            for (size_t e = 0; e < 3; ++e)
+            {
+                const size_t a = _tris[t + e];
+                const size_t b = _tris[t + (e + 1) % 3];
+                edges[fill[a]++] = static_cast<uint32_t>(b);
+                edges[fill[b]++] = static_cast<uint32_t>(a);
+            }
+        }
+
+        adjacency.offsets.assign(node_count + 1, 0);
+        adjacency.neighbours.clear();
+        adjacency.neighbours.reserve(edges.size() / 2);
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            const auto row_begin = edges.begin() + counts[i];
+            const auto row_end = edges.begin() + counts[i + 1];
+            std::sort(row_begin, row_end);
+
+            adjacency.neighbours.insert(adjacency.neighbours.end(), row_begin, std::unique(row_begin, row_end));
+            adjacency.offsets[i + 1] = static_cast<uint32_t>(adjacency.neighbours.size());
+        }
+    }
+
+    // The neighbour lists are only built when `storage` asks for them, their
+    // edge list then comes from scratch files next to the mesh storage.
+    terra::dynarray<terra::triangle> triangulate(scheduler& sched,
+                                                 const std::vector<terra::vec2>& points,
+                                                 size_t width,
+                                                 float radius,
+                                                 const mesh_storage& storage,
+                                                 mesh_adjacency& adjacency,
+                                                 profile& prof)
+    {
+        profile::scope stage(prof, "triangulate");
+        stage.set_nodes(points.size());
+
+        // the edge list is filled in triangle order, the lists are read by node
+        const auto scratch = make_storage(storage, access_pattern::random);
+        auto neighbours = [&](const auto& indices)
+        {
+            if (storage.neighbours)
+            {
+                build_adjacency(points.size(), indices, adjacency, storage_resource(scratch));
+            }
+        };
+
+        terra::dynarray<terra::triangle> tris(0);
+        std::vector<uint32_t> indices;
+        if (triangulate_strips(sched, points, static_cast<tfloat>(width), radius, tris, storage.neighbours ? &indices : nullptr))
+        {
+            neighbours(indices);
+            std::cout << "Triangles created: " << tris.size() << " in strips" << std::endl;
+
+            return tris;
+        }
+
+        terra::delaunator d;
+        auto _tris = d.triangulate(points);
+        neighbours(_tris);
+
+        // delaunator hands back flat indices and terra's graph takes
+        // triangles, this is the one copy between the two
+        tris = terra::dynarray<terra::triangle>(_tris.size() / 3);
+
+        sched.parallel_for(0, tris.size(), node_grain, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                size_t index = i * 3;
+                const size_t p0 = index;
+                const size_t p1 = index + 1;
+                const size_t p2 = index + 2;
+
+                const size_t v0 = _tris[p0];
+                const size_t v1 = _tris[p1];
+                const size_t v2 = _tris[p2];
+
+                tris[i] = terra::triangle(v0, v1, v2);
+            }
+        });
+
+        std::cout << "Triangles created: " << tris.size() << std::endl;
+
+        return tris;
+    }
+
+    terra::dynarray<tfloat> cell_areas(scheduler& sched,
+                                       const std::vector<terra::vec2>& points,
+                                       size_t width,
+                                       size_t height,
+                                       float radius,
+                                       const std::vector<tfloat>& spacing,
+                                       profile& prof)
+    {
+        profile::scope stage(prof, "voronoi areas");
+
+        const size_t node_count = points.size();
+        stage.set_nodes(node_count);
+
+        terra::dynarray<tfloat> areas(node_count);
+        {
+            terra::dynarray<terra::polygon> cells(points.size());
+            {
+                terra::voronoi v;
+                v.generate(points, terra::rect<tfloat>(0.0f, 0.0f, static_cast<tfloat>(width), static_cast<tfloat>(height)), cells);
+            }
+
+            // cells without vertices are only flagged here and reported below,
+            // so the output of the workers does not interleave
+            std::vector<uint8_t> missing(node_count, 0);
+            sched.parallel_for(0, node_count, node_grain, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const auto& cell = cells[i];
+                    if (cell.vertices.size() > 0)
+                    {
+                        areas[i] = cell.area(points[i]);
+                    }
+                    else
+                    {
+                        missing[i] = 1;
+                    }
+                }
+            });
+
+            for (size_t i = 0; i < node_count; ++i)
+            {
+                const auto& centre = points[i];
+                if (missing[i])
+                {
+                    std::cout << "no vertices at: #" << i << " - { " << centre.x << "," << centre.y << " }" << std::endl;
+                }
+                else if (areas[i] < 0.0)
+                {
+                    std::cout << "bad area \"" << areas[i] << "\" at: " << i << " - { " << centre.x << "," << centre.y << " }" << std::endl;
+                }
+
+                if (missing[i] || areas[i] < 0.0)
+                {
+                    const tfloat r = spacing.empty() ? radius : spacing[i];
+                    const auto area = terra::math::PI * (r * r);
+                    areas[i] = area;
+                }
+
+                // area needs to be in m^2?
+                // areas[i] *= 1'000'000.0;
+            }
+        }
+
+        std::cout << "Voronoi partition completed, areas computed" << std::endl;
+
+        return areas;
+    }
+}
+
+lstgtufe_mesh::lstgtufe_mesh(scheduler& sched, profile& prof, size_t width, size_t height, float radius, size_t samples, const mesh_storage& storage) :
+    width(width),
+    height(height),
+    radius(radius),
+    storage(make_storage(storage, access_pattern::sequential)),
+    points([&]()
+    {
+        auto sampled = sample_points(width, height, radius, samples, hash_grid, prof);
+        if (storage.reorder)
+        {
+            // the hash_grid indexes the sampler's order
+            reorder_points(sampled, width, height, prof);
+            hash_grid.reset();
+        }
+
+        return sampled;
+    }()),
+    adjacency(storage_resource(this->storage)),
+    tris(triangulate(sched, points, width, radius, storage, adjacency, prof)),
+    graph([&]()
+    {
+        profile::scope stage(prof, "graph");
+        stage.set_nodes(points.size());
+        return terra::undirected_graph(points.size(), tris);
+    }()),
+    areas(cell_areas(sched, points, width, height, radius, spacing, prof))
+{
+    std::cout << "Graph edges: " << graph.num_edges() << std::endl;
 }
 
-bool configure_lstgtufe(const argh::parser& cmdl, const output& out)
+lstgtufe_mesh::lstgtufe_mesh(scheduler& sched,
+                             profile& prof,
+                             size_t width,
+                             size_t height,
+                             float radius,
+                             std::vector<terra::vec2> points,
+                             std::vector<tfloat> spacing,
+                             const mesh_storage& storage) :
+    width(width),
+    height(height),
+    radius(radius),
+    storage(make_storage(storage, access_pattern::sequential)),
+    points(std::move(points)),
+    adjacency(storage_resource(this->storage)),
+    // strips are cut by the coarsest spacing so their margins hold enough
+    // neighbours everywhere
+    tris(triangulate(sched,
+                     this->points,
+                     width,
+                     spacing.empty() ? radius : *std::max_element(spacing.begin(), spacing.end()),
+                     storage,
+                     adjacency,
+                     prof)),
+    graph([&]()
+    {
+        profile::scope stage(prof, "graph");
+        stage.set_nodes(this->points.size());
+        return terra::undirected_graph(this->points.size(), tris);
+    }()),
+    spacing(std::move(spacing)),
+    areas(cell_areas(sched, this->points, width, height, radius, this->spacing, prof))
 {
-    size_t width            = 50000;
-    size_t height           = 50000;
-    float radius            = 100.0;
-    size_t samples          = 100;
-    float uplift_per_year   = 5.01e-4;
-    float erosion_rate      = 5.61e-7;
-    float time_scale        = 2.5e5;
-    size_t max_itterations  = 300;
+    std::cout << "Graph edges: " << graph.num_edges() << std::endl;
+}
 
+void read_lstgtufe_settings(const argh::parser& cmdl, lstgtufe_settings& settings)
+{
     // Poisson disc sampler options
-    cmdl(2, 50000) >> width;
-    cmdl(3, 50000) >> height;
-    cmdl(4, 100.0) >> radius;
-    cmdl(5, 100)   >> samples;
+    cmdl(2, 50000) >> settings.width;
+    cmdl(3, 50000) >> settings.height;
+    cmdl(4, 100.0) >> settings.radius;
+    cmdl(5, 100)   >> settings.samples;
 
     // Simulation options
-    cmdl(6,  5.01e-4) >> uplift_per_year;
-    cmdl(7,  5.61e-7) >> erosion_rate;
-    cmdl(8,  2.5e5)   >> time_scale;
-    cmdl(9,  300)     >> max_itterations;
+    cmdl(6,  5.01e-4) >> settings.uplift_per_year;
+    cmdl(7,  5.61e-7) >> settings.erosion_rate;
+    cmdl(8,  2.5e5)   >> settings.time_scale;
+    cmdl(9,  300)     >> settings.max_itterations;
+    // flags followed by a value parse as params
+    settings.adaptive = cmdl["adaptive"] || cmdl("adaptive");
+
+    // Storage options
+    cmdl("--storage", "") >> settings.storage.directory;
+    settings.storage.reorder = cmdl["reorder"] || cmdl("reorder");
+    settings.storage.neighbours = settings.adaptive;
+}
+
+bool configure_lstgtufe(const argh::parser& cmdl, const output& out, scheduler& sched)
+{
+    lstgtufe_settings settings;
+    read_lstgtufe_settings(cmdl, settings);
+
+    size_t shards = 1;
+    cmdl("--shards", 1) >> shards;
+    if (shards > 1)
+    {
+        return lstgtufe_sharded(cmdl, out, sched, settings, shards);
+    }
+
+    std::string ensemble;
+    cmdl("--ensemble", "") >> ensemble;
+    if (!ensemble.empty())
+    {
+        return lstgtufe_ensemble(cmdl, out, sched, settings, ensemble);
+    }
 
+    std::string density;
+    cmdl("--density", "") >> density;
+    if (!density.empty())
+    {
+        return lstgtufe_density(cmdl, out, sched, settings, density);
+    }
+
+    std::string warm_start;
+    std::string save_state;
+    cmdl("--warm-start", "") >> warm_start;
+    cmdl("--save-state", "") >> save_state;
+
+    const bool perf = cmdl["perf"] || cmdl("perf");
+    profile prof(perf || cmdl["profile"] || cmdl("profile"), perf);
     lstgtufe(out,
-             width,
-             height,
-             radius,
-             samples,
-             uplift_per_year,
-             erosion_rate,
-             time_scale);
+             sched,
+             prof,
+             settings.width,
+             settings.height,
+             settings.radius,
+             settings.samples,
+             settings.uplift_per_year,
+             settings.erosion_rate,
+             settings.time_scale,
+             settings.max_itterations,
+             settings.adaptive,
+             settings.storage,
+             warm_start,
+             save_state);
+
+    prof.print(std::cout);
 
     return true;
 }
 
 void lstgtufe(const output& out,
+              scheduler& sched,
+              profile& prof,
               size_t width,
               size_t height,
               float radius,
@@ -65,143 +468,338 @@ void lstgtufe(const output& out,
               float uplift_per_year,
               float erosion_rate,
               float time_scale,
-              size_t max_itterations)
+              size_t max_itterations,
+              bool adaptive,
+              const mesh_storage& storage,
+              const std::string& warm_start,
+              const std::string& save_state)
 {
-    tfloat uplift_factor = uplift_per_year * time_scale;
-
-    tfloat k = erosion_rate * time_scale;
-    tfloat m = 0.5;
-    tfloat n = 1.0;
+    lstgtufe_settings settings;
+    settings.width = width;
+    settings.height = height;
+    settings.radius = radius;
+    settings.samples = samples;
+    settings.uplift_per_year = uplift_per_year;
+    settings.erosion_rate = erosion_rate;
+    settings.time_scale = time_scale;
+    settings.max_itterations = max_itterations;
+    settings.adaptive = adaptive;
+    settings.storage = storage;
+
+    lstgtufe_mesh mesh(sched, prof, width, height, radius, samples, storage);
+
+    terra::dynarray<tfloat> heights(0);
+    const size_t saved_from = lstgtufe_warm_start(sched, warm_start, mesh, heights);
+    const size_t itterations = lstgtufe_erode(sched, prof, mesh, settings, heights);
+    lstgtufe_save_state(save_state, mesh, heights, itterations, saved_from);
+
+    profile::scope stage(prof, "write");
+    stage.set_nodes(mesh.points.size());
+    lstgtufe_write(sched, out, mesh, heights);
+}
 
-    std::vector<terra::vec2> points;
-    std::unique_ptr<terra::hash_grid> hash_grid;
+namespace
+{
+    std::string arena_note(const char* name, const arena& a)
     {
-        terra::hash_grid* temp_grid = nullptr;
-        auto sampler = terra::poisson_disc_sampler();
-        points = sampler.sample(width, height, radius, samples, &temp_grid);
+        std::ostringstream note;
+        note << std::fixed << std::setprecision(1)
+             << name << " arena: " << static_cast<double>(a.mapped()) / (1 << 20) << "MB mapped, ";
+        if (a.file_backed())
+        {
+            note << "backed by scratch files";
+        }
+        else
+        {
+            note << static_cast<double>(a.huge_mapped()) / (1 << 20) << "MB on huge pages";
+        }
 
-        hash_grid = std::unique_ptr<terra::hash_grid>(temp_grid);
+        return note.str();
     }
-    const size_t node_count = points.size();
-
-    std::cout << "Points sampled: " << points.size() << std::endl;
 
-    terra::dynarray<terra::triangle> tris(0);
+    // The largest height change of the last step, and the largest change of
+    // slope along an edge, which is what thermal erosion has to carry away.
+    struct step_change
     {
-        terra::delaunator d;
-        auto _tris = d.triangulate(points);
-        tris = terra::dynarray<terra::triangle>(_tris.size() / 3);
+        tfloat height;
+        tfloat slope;
+    };
+
+    step_change measure_step(scheduler& sched,
+                             const lstgtufe_mesh& mesh,
+                             const terra::dynarray<tfloat>& heights,
+                             const std::pmr::vector<tfloat>& heights_old,
+                             std::pmr::memory_resource* scratch)
+    {
+        const auto& adjacency = mesh.adjacency;
 
-        for (size_t i = 0; i < tris.size(); ++i)
-        {
-            size_t index = i * 3;
-            const size_t p0 = index;
-            const size_t p1 = index + 1;
-            const size_t p2 = index + 2;
+        return sched.parallel_reduce(0, heights.size(), node_grain, step_change{ 0.0f, 0.0f },
+            [&](size_t begin, size_t end)
+            {
+                step_change change = { 0.0f, 0.0f };
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const tfloat dh = heights[i] - heights_old[i];
+                    change.height = std::max(change.height, terra::math::abs(dh));
+
+                    for (uint32_t e = adjacency.offsets[i]; e < adjacency.offsets[i + 1]; ++e)
+                    {
+                        const uint32_t j = adjacency.neighbours[e];
+                        if (j < i)
+                        {
+                            continue;
+                        }
+
+                        const tfloat dx = mesh.points[j].x - mesh.points[i].x;
+                        const tfloat dy = mesh.points[j].y - mesh.points[i].y;
+                        const tfloat distance = std::sqrt(dx * dx + dy * dy);
+                        if (distance > 0.0f)
+                        {
+                            const tfloat dj = heights[j] - heights_old[j];
+                            change.slope = std::max(change.slope, terra::math::abs(dh - dj) / distance);
+                        }
+                    }
+                }
+
+                return change;
+            },
+            [](step_change a, step_change b)
+            {
+                return step_change{ std::max(a.height, b.height), std::max(a.slope, b.slope) };
+            },
+            scratch);
+    }
 
-            const size_t v0 = _tris[p0];
-            const size_t v1 = _tris[p1];
-            const size_t v2 = _tris[p2];
+    // Steps are time_scale * 2^level, so dt only changes by whole factors of
+    // two and the stream power solver is rebuilt rarely.
+    const int min_step_level = -4;
+    const int max_step_level = 6;
 
-            tris[i] = terra::triangle(v0, v1, v2);
-        }
+    // fraction of the talus slope a single step may add along an edge
+    const tfloat step_cfl = 0.5f;
+}
 
-        std::cout << "Triangles created: " << tris.size() << std::endl;
+size_t lstgtufe_erode(scheduler& sched,
+                      profile& prof,
+                      const lstgtufe_mesh& mesh,
+                      const lstgtufe_settings& settings,
+                      terra::dynarray<tfloat>& heights,
+                      std::ostream& log)
+{
+    const size_t node_count = mesh.points.size();
+    if (settings.adaptive && mesh.adjacency.offsets.size() != node_count + 1)
+    {
+        throw std::invalid_argument("adaptive stepping needs a mesh with neighbour lists");
     }
 
-    terra::undirected_graph graph(node_count, tris);
-    std::cout << "Graph edges: " << graph.num_edges() << std::endl;
+    tfloat uplift_factor = settings.uplift_per_year * settings.time_scale;
 
-    terra::dynarray<tfloat> areas(node_count);
-    {
-        terra::dynarray<terra::polygon> cells(points.size());
-        {
-            terra::voronoi v;
-            v.generate(points, terra::rect<tfloat>(0.0f, 0.0f, static_cast<tfloat>(width), static_cast<tfloat>(height)), cells);
-        }
+    tfloat k = settings.erosion_rate * settings.time_scale;
 
-        for (size_t i = 0; i < node_count; ++i)
-        {
-            const auto& cell = cells[i];
-            const auto& centre = points[i];
-            if (cell.vertices.size() > 0)
-            {
-                areas[i] = cell.area(centre);
-            }
-            else
-            {
-                std::cout << "no vertices at: #" << i << " - { " << centre.x << "," << centre.y << " }" << std::endl;
-            }
-        }
+    // buffers that live for the whole run come from `run`, temporaries of a
+    // single iteration come from `scratch` which is rewound every iteration
+    arena run(64 << 20, settings.storage.directory);
+    arena scratch(1 << 20);
 
-        for (size_t i = 0; i < node_count; ++i)
-        {
-            if (areas[i] < 0.0)
-            {
-                const auto& centre = points[i];
-                std::cout << "bad area \"" << areas[i] << "\" at: " << i << " - { " << centre.x << "," << centre.y << " }" << std::endl;
-                
-                static const auto area = terra::math::PI * (radius * radius);
-                areas[i] = area;
-            }
+    // heights_old is only ever copied into and compared in node order
+    run.advise(access_pattern::sequential);
 
-            // area needs to be in m^2?
-            // areas[i] *= 1'000'000.0;
-        }
+    auto setup = std::make_unique<profile::scope>(prof, "erosion setup");
+    setup->set_nodes(node_count);
+
+    // a warm start waits in heights_old until the solvers are set up, so
+    // uplift is computed over flat ground either way
+    std::pmr::vector<tfloat> heights_old(node_count, &run);
+    const bool warm = heights.size() == node_count && node_count > 0;
+    if (warm)
+    {
+        std::copy(heights.begin(), heights.end(), heights_old.begin());
     }
 
-    std::cout << "Voronoi partition completed, areas computed" << std::endl;
+    heights = terra::dynarray<tfloat>(node_count);
+    std::fill(heights.begin(), heights.end(), 0.0f);
 
-    terra::dynarray<tfloat> heights(node_count);
+    terra::linear_uplift uplift_func(mesh.width, mesh.height, 0.01, 1.0);
+    terra::uplift uplift(uplift_func, mesh.points, heights, uplift_factor);
+    terra::flow_graph flow_graph(node_count, mesh.graph, mesh.areas, heights);
+
+    std::optional<terra::stream_power_equation> fluvial_erosion;
+    fluvial_erosion.emplace(k, settings.time_scale, mesh.points, flow_graph, mesh.areas, uplift.uplifts, heights);
+    terra::thermal_erosion thermal_erosion(mesh.points, heights, mesh.graph, 40.0);
+
+    if (warm)
     {
-        terra::dynarray<tfloat> heights_old(node_count);
-        std::fill(heights.begin(), heights.end(), 0.0f);
+        std::copy(heights_old.begin(), heights_old.end(), heights.begin());
+    }
 
-        terra::linear_uplift uplift_func(width, height, 0.01, 1.0);
-        terra::uplift uplift(uplift_func, points, heights, uplift_factor);
-        terra::flow_graph flow_graph(node_count, graph, areas, heights);
+    // adaptive stepping state, see --adaptive
+    const tfloat slope_limit = step_cfl * std::tan(40.0f * terra::math::PI / 180.0f);
+    int step_level = 0;
+    tfloat dt = settings.time_scale;
+    tfloat previous_change = std::numeric_limits<tfloat>::max();
+    double simulated = 0.0;
 
-        terra::stream_power_equation fluvial_erosion(k, time_scale, points, flow_graph, areas, uplift.uplifts, heights);
-        terra::thermal_erosion thermal_erosion(points, heights, graph, 40.0);
+    setup.reset();
 
-        size_t itterations = 0;
+    size_t itterations = 0;
+    {
+        profile::scope loop(prof, "erosion loop");
+        loop.set_nodes(node_count);
+
+        size_t passes = 0;
+        bool changing = true;
         do
         {
-            std::copy(heights.begin(), heights.end(), heights_old.begin());
+            scratch.reset();
+            ++passes;
+
+            sched.parallel_for(0, node_count, node_grain, [&](size_t begin, size_t end)
+            {
+                std::copy(heights.begin() + begin, heights.begin() + end, heights_old.begin() + begin);
+            });
 
             // update
             flow_graph.update();
 
             // erode
-            fluvial_erosion.update();
+            fluvial_erosion->update();
             thermal_erosion.update();
+
+            if (!settings.adaptive)
+            {
+                changing = end_function(sched, heights, heights_old, &scratch);
+                continue;
+            }
+
+            const auto change = measure_step(sched, mesh, heights, heights_old, &scratch);
+            simulated += dt;
+
+            // converged once heights change slower than a fixed step allows
+            changing = change.height * settings.time_scale / dt > terrain_epsilon;
+
+            log << "Iteration " << itterations << ": dt " << dt << " years, max change " << change.height
+                      << ", max slope change " << change.slope << std::endl;
+
+            // halve dt when a step steepens edges faster than thermal erosion
+            // can relax them, double it while the terrain settles well inside
+            // that bound
+            int next_level = step_level;
+            if (change.slope > slope_limit && step_level > min_step_level)
+            {
+                --next_level;
+            }
+            else if (change.slope < 0.25f * slope_limit && change.height <= previous_change && step_level < max_step_level)
+            {
+                ++next_level;
+            }
+            previous_change = change.height;
+
+            if (next_level != step_level)
+            {
+                const tfloat next_dt = std::ldexp(settings.time_scale, next_level);
+                const tfloat ratio = next_dt / dt;
+                for (auto& u : uplift.uplifts)
+                {
+                    u *= ratio;
+                }
+
+                step_level = next_level;
+                dt = next_dt;
+                fluvial_erosion.emplace(settings.erosion_rate * dt, dt, mesh.points, flow_graph, mesh.areas, uplift.uplifts, heights);
+            }
         }
-        while (end_function(heights, heights_old) && (++itterations) < max_itterations);
+        while (changing && (++itterations) < settings.max_itterations);
+
+        loop.set_itterations(passes);
+    }
 
-        std::cout << "Graph converged in " << itterations << " iterations" << std::endl;
+    log << "Graph converged in " << itterations << " iterations" << std::endl;
+    if (settings.adaptive)
+    {
+        log << "Simulated " << simulated << " years" << std::endl;
+    }
+
+    prof.note(arena_note("run", run));
+    if (mesh.storage)
+    {
+        prof.note(arena_note("mesh storage", *mesh.storage));
     }
+    prof.note(arena_note("scratch", scratch));
 
+    return itterations;
+}
+
+bool lstgtufe_write(scheduler& sched, const output& out, const lstgtufe_mesh& mesh, const terra::dynarray<tfloat>& heights)
+{
     switch (out.type)
     {
         case output_type::heightfield:
         {
-            terra::rasteriser r(heights, *hash_grid.get());
+            if (heights.size() == 0)
+            {
+                break;
+            }
+
+            // terra rasters 8 bit images at a fixed size, anything else is
+            // rastered from the nearest node here
+            if (mesh.hash_grid == nullptr || out.image.bits != 8 || out.image.raster != 512)
+            {
+                const size_t size = out.image.raster;
+                const auto [min, max] = std::minmax_element(heights.begin(), heights.end());
+                const point_grid grid(mesh.points, mesh.radius);
+                const tfloat scale_x = static_cast<tfloat>(mesh.width) / size;
+                const tfloat scale_y = static_cast<tfloat>(mesh.height) / size;
+
+                terra::dynarray<tfloat> raster(size * size);
+                sched.parallel_for(0, size, 16, [&](size_t row_begin, size_t row_end)
+                {
+                    for (size_t y = row_begin; y < row_end; ++y)
+                    {
+                        for (size_t x = 0; x < size; ++x)
+                        {
+                            const terra::vec2 p = { (static_cast<tfloat>(x) + 0.5f) * scale_x, (static_cast<tfloat>(y) + 0.5f) * scale_y };
+                            const size_t nearest = grid.nearest(p);
+                            raster[y * size + x] = nearest == point_grid::npos ? 0.0f : heights[nearest];
+                        }
+                    }
+                });
+
+                if (out.image.format == image_format::png)
+                {
+                    return write_png(sched, out.path, size, size, &raster[0], *min, *max, out.image);
+                }
+
+                terra::heightfield h;
+                auto bitmap = h.raster<float>(size, size, *min, *max, raster);
+                terra::io::write_image(out.path, bitmap);
+                break;
+            }
+
+            terra::rasteriser r(heights, *mesh.hash_grid.get());
             auto hf = r.raster<uint8_t>(512, 512);
             auto bitmap = terra::bitmap(512, 512, 8, 1, 512 * 512, hf);
 
             terra::io::write_image(out.path, bitmap);
-        };
+            break;
+        }
         case output_type::model:
         {
-            terra::dynarray<terra::vec3> verts(points.size());
-            for (size_t i = 0; i < node_count; ++i)
-            {
-                const auto& p = points[i];
-                verts[i] = { p.x, p.y, heights[i] };
-            }
+            const size_t node_count = mesh.points.size();
 
-            terra::io::obj::write_obj(out.path, verts, tris);
-        };
+            terra::dynarray<terra::vec3> verts(node_count);
+            sched.parallel_for(0, node_count, node_grain, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const auto& p = mesh.points[i];
+                    verts[i] = { p.x, p.y, heights[i] };
+                }
+            });
+
+            terra::io::obj::write_obj(out.path, verts, mesh.tris);
+            break;
+        }
     }
-    
+
+    return true;
 }
@@ -10,13 +10,18 @@
 
 #include "usage.hpp"
 #include "output.hpp"
+#include "batch.hpp"
 #include "lstgtufe.hpp"
 #include "noise.hpp"
+#include "png_writer.hpp"
 #include "simulation.hpp"
+#include "scheduler.hpp"
+#include "shard.hpp"
+#include "tile_server.hpp"
 
 struct function
 {
-    typedef std::function<bool(const argh::parser&, const output&)> callback_t;
+    typedef std::function<bool(const argh::parser&, const output&, scheduler&)> callback_t;
 
     function(const std::string_view& name, const std::string_view& usage, callback_t callback) : name(name), usage(usage), callback(callback)
     {
@@ -27,11 +32,14 @@ struct function
     callback_t callback;
 };
 
-std::array<function, 3> functions =
+std::array<function, 6> functions =
 {
     function("lstgtufe",   "usage", configure_lstgtufe),
     function("noise",      "usage", configure_noise),
-    function("simulation", "usage", configure_simulation)
+    function("simulation", "usage", configure_simulation),
+    function("batch",      "usage: prmrdl batch <manifest>", configure_batch),
+    function("serve",      "usage: prmrdl serve <socket> [--cache-mb <n>] [--spill <dir>] [--spill-mb <n>]", configure_serve),
+    function("shard",      "usage: started by lstgtufe --shards <n>", configure_shard)
 };
 
 int32_t main(int32_t argc, char** argv)
@@ -52,14 +60,17 @@ int32_t main(int32_t argc, char** argv)
 
     std::string out_path;
     cmdl({"-o", "--output"}, "temp_hf.png") >> out_path;
-    output out = { out_path, output_type::heightfield };
+    output out = { out_path, output_type_of(out_path), read_image_settings(cmdl, out_path) };
+
+    // every verb shares one scheduler, see --threads and --affinity
+    auto sched = make_scheduler(cmdl);
 
     bool found = false;
     for (const auto& f : functions)
     {
         if (function == f.name)
         {
-            if (!f.callback(cmdl, out))
+            if (!f.callback(cmdl, out, *sched))
             {
                 print_title();
                 std::cout << f.usage << std::endl;
@@ -76,5 +87,10 @@ int32_t main(int32_t argc, char** argv)
         print_usage();
     }
 
+    if (cmdl["scheduler-stats"] || cmdl("scheduler-stats"))
+    {
+        sched->print_stats(std::cout);
+    }
+
     return 0;
 }
@@ -1,11 +1,14 @@
 #include "noise.hpp"
 
+#include <algorithm>
 #include <array>
 #include <functional>
 #include <string_view>
 
 #include <terra/terra.hpp>
 
+#include "png_writer.hpp"
+#include "profile.hpp"
 #include "usage.hpp"
 
 terra::dynarray<tfloat> fbm_noise(size_t, size_t, size_t, size_t, float, size_t, size_t,  float, float);
@@ -26,16 +29,62 @@ struct noise_function
     callback_t callback;
 };
 
-bool configure_noise(const argh::parser& cmdl, const output& out)
+const std::array<noise_function, 4> noise_types =
 {
-    const std::array<noise_function, 4> noise_types =
+    noise_function("fBm", "another desc here pls", fbm_noise),
+    noise_function("billowy", "another desc here pls", billowy_noise),
+    noise_function("ridged", "another desc here pls", ridged_noise),
+    noise_function("erosive", "desc here pls", erosive_noise)
+};
+
+bool read_noise_settings(const argh::parser& cmdl, size_t first, noise_settings& settings)
+{
+    cmdl(first,     0ull)    >> settings.x_off;
+    cmdl(first + 1, 0ull)    >> settings.y_off;
+    cmdl(first + 2, 512ull)  >> settings.x_size;
+    cmdl(first + 3, 512ull)  >> settings.y_size;
+    cmdl(first + 4, 0.125f)  >> settings.scale;
+    cmdl(first + 5, 2552ull) >> settings.seed;
+    cmdl(first + 6, 6ull)    >> settings.octaves;
+    cmdl(first + 7, 0.5f)    >> settings.persistence;
+    cmdl(first + 8, 2.0f)    >> settings.lacunarity;
+
+    if (settings.x_size == 0 || settings.y_size == 0)
     {
-        noise_function("fBm", "another desc here pls", fbm_noise),
-        noise_function("billowy", "another desc here pls", billowy_noise),
-        noise_function("ridged", "another desc here pls", ridged_noise),
-        noise_function("erosive", "desc here pls", erosive_noise)
-    };
+        std::cout << "Noise must be at least 1x1, not " << settings.x_size << "x" << settings.y_size << std::endl;
+        return false;
+    }
 
+    return settings.octaves > 0;
+}
+
+bool generate_noise(const std::string& type, const noise_settings& settings, terra::dynarray<tfloat>& noise_set)
+{
+    for (const auto& n : noise_types)
+    {
+        if (type == n.name)
+        {
+            // one call, terra's layout and normalisation of partial fields
+            // are not known well enough to stitch strips together
+            noise_set = n.callback(settings.x_off,
+                                   settings.y_off,
+                                   settings.x_size,
+                                   settings.y_size,
+                                   settings.scale,
+                                   settings.seed,
+                                   settings.octaves,
+                                   settings.persistence,
+                                   settings.lacunarity);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool configure_noise(const argh::parser& cmdl, const output& out, scheduler& sched)
+{
     auto type = cmdl[2];
     if (type == "list")
     {
@@ -47,49 +96,51 @@ bool configure_noise(const argh::parser& cmdl, const output& out)
         }
     }
 
-    size_t x_off;
-    size_t y_off;
-    size_t x_size;
-    size_t y_size;
-    float scale;
-    size_t seed;
-    size_t octaves;
-    float persistence;
-    float lacunarity;
-
-    cmdl(3, 0ull) >> x_off;
-    cmdl(4, 0ull) >> y_off;
-    cmdl(5, 512ull) >> x_size;
-    cmdl(6, 512ull) >> y_size;
-    cmdl(7, 0.125f) >> scale;
-    cmdl(8, 2552ull) >> seed;
-    cmdl(9, 6ull) >> octaves;
-    cmdl(10, 0.5f) >> persistence;
-    cmdl(11, 2.0f) >> lacunarity;
-
-    bool found = false;
-    for (const auto& n : noise_types)
+    noise_settings settings;
+    if (!read_noise_settings(cmdl, 3, settings))
     {
-        if (type == n.name)
-        {
-            auto noise_set = n.callback(x_off, y_off, x_size, y_size, scale, seed, octaves, persistence, lacunarity);
-            if (noise_set.size() > 0)
-            {
-                terra::heightfield h;
-                auto bitmap = h.raster<float>(512, 512, 0.0f, 1.0f, noise_set);
+        return false;
+    }
 
-                terra::io::write_image(out.path, bitmap);
-            }
+    const bool perf = cmdl["perf"] || cmdl("perf");
+    profile prof(perf || cmdl["profile"] || cmdl("profile"), perf);
+    const size_t node_count = settings.x_size * settings.y_size;
 
-            found = true;
-            break;
+    terra::dynarray<tfloat> noise_set(0);
+    {
+        profile::scope stage(prof, type);
+        stage.set_nodes(node_count);
+        if (!generate_noise(type, settings, noise_set))
+        {
+            // help stuff here
+            return false;
         }
     }
 
-    if (!found)
     {
-        // help stuff here
-        return false;
+        profile::scope stage(prof, "write");
+        stage.set_nodes(node_count);
+        noise_write(sched, out, settings, noise_set);
+    }
+
+    prof.print(std::cout);
+
+    return true;
+}
+
+bool noise_write(scheduler& sched, const output& out, const noise_settings& settings, const terra::dynarray<tfloat>& noise_set)
+{
+    if (noise_set.size() > 0)
+    {
+        if (out.image.format == image_format::png)
+        {
+            return write_png(sched, out.path, settings.x_size, settings.y_size, &noise_set[0], 0.0f, 1.0f, out.image);
+        }
+
+        terra::heightfield h;
+        auto bitmap = h.raster<float>(512, 512, 0.0f, 1.0f, noise_set);
+
+        terra::io::write_image(out.path, bitmap);
     }
 
     return true;
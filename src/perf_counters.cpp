@@ -0,0 +1,169 @@
+#include "perf_counters.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+    struct event_config
+    {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    const std::array<event_config, perf_counters::counter_count> configs =
+    {{
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | cache_read_miss }
+    }};
+
+    int open_event(const event_config& config, pid_t tid)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = config.type;
+        attr.config = config.config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // user space only, which is all perf_event_paranoid 2 allows
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0));
+    }
+
+    std::vector<pid_t> process_threads()
+    {
+        std::vector<pid_t> threads;
+
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator("/proc/self/task", error))
+        {
+            threads.push_back(static_cast<pid_t>(std::stol(entry.path().filename().string())));
+        }
+
+        if (threads.empty())
+        {
+            threads.push_back(0);
+        }
+
+        return threads;
+    }
+#endif
+}
+
+perf_counters::perf_counters()
+{
+    this->opened.fill(false);
+
+#ifdef __linux__
+    const auto threads = process_threads();
+    for (size_t c = 0; c < counter_count; ++c)
+    {
+        std::vector<event_t> opened_events;
+        int failure = 0;
+        for (const auto tid : threads)
+        {
+            const int fd = open_event(configs[c], tid);
+            if (fd < 0)
+            {
+                // threads that exited since they were listed are not a failure
+                if (errno == ESRCH)
+                {
+                    continue;
+                }
+
+                failure = errno;
+                break;
+            }
+
+            opened_events.push_back({ fd, static_cast<counter>(c) });
+        }
+
+        // a counter that can only be read on some threads is not counted at all
+        if (failure != 0 || opened_events.empty())
+        {
+            for (const auto& event : opened_events)
+            {
+                close(event.fd);
+            }
+
+            if (this->first_error.empty())
+            {
+                this->first_error = std::string(name(static_cast<counter>(c))) + ": " + std::strerror(failure != 0 ? failure : ESRCH);
+            }
+            continue;
+        }
+
+        this->opened[c] = true;
+        this->events.insert(this->events.end(), opened_events.begin(), opened_events.end());
+    }
+#else
+    this->first_error = "hardware counters need Linux perf_event_open";
+#endif
+}
+
+perf_counters::~perf_counters()
+{
+#ifdef __linux__
+    for (const auto& event : this->events)
+    {
+        close(event.fd);
+    }
+#endif
+}
+
+bool perf_counters::any_available() const
+{
+    return std::find(this->opened.begin(), this->opened.end(), true) != this->opened.end();
+}
+
+perf_counters::values_t perf_counters::read() const
+{
+    values_t values;
+    values.fill(0.0);
+
+#ifdef __linux__
+    for (const auto& event : this->events)
+    {
+        uint64_t data[3] = { 0, 0, 0 };
+        if (::read(event.fd, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[2] == 0)
+        {
+            continue;
+        }
+
+        values[event.c] += static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]);
+    }
+#endif
+
+    return values;
+}
+
+const char* perf_counters::name(counter c)
+{
+    switch (c)
+    {
+        case cycles:        return "cycles";
+        case instructions:  return "instructions";
+        case llc_misses:    return "llc misses";
+        case branch_misses: return "branch misses";
+        case dtlb_misses:   return "dtlb misses";
+        default:            return "unknown";
+    }
+}
@@ -0,0 +1,253 @@
+#include "png_writer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <zlib.h>
+
+namespace
+{
+    // raw bytes per strip, small enough to balance and large enough that the
+    // sync flush between strips costs nothing measurable
+    const size_t strip_bytes = 1 << 20;
+
+    struct strip_t
+    {
+        std::vector<uint8_t> chunk;
+        uLong adler;
+        size_t raw_size;
+    };
+
+    void put_u32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // Frames `data` as a chunk, the length and crc are written around it.
+    std::vector<uint8_t> make_chunk(const char* type, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> chunk;
+        chunk.reserve(data.size() + 12);
+        put_u32(chunk, static_cast<uint32_t>(data.size()));
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+
+        const uLong crc = crc32(0, chunk.data() + 4, static_cast<uInt>(data.size() + 4));
+        put_u32(chunk, static_cast<uint32_t>(crc));
+
+        return chunk;
+    }
+
+    uint8_t zlib_flags(int level)
+    {
+        const uint8_t cmf = 0x78;
+        const uint8_t flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        uint8_t flg = static_cast<uint8_t>(flevel << 6);
+        flg = static_cast<uint8_t>(flg + (31 - (cmf * 256 + flg) % 31));
+
+        return flg;
+    }
+
+    // Converts rows [begin, end) to samples, applies the Up filter and
+    // deflates them as raw deflate data.
+    bool encode_strip(const tfloat* values,
+                      size_t width,
+                      size_t begin,
+                      size_t end,
+                      tfloat min,
+                      tfloat scale,
+                      size_t bytes_per_sample,
+                      int level,
+                      bool last,
+                      strip_t& strip)
+    {
+        const size_t row_bytes = width * bytes_per_sample;
+        const float top = bytes_per_sample == 1 ? 255.0f : 65535.0f;
+
+        auto sample_row = [&](size_t y, uint8_t* row)
+        {
+            const tfloat* v = values + y * width;
+            for (size_t x = 0; x < width; ++x)
+            {
+                const float s = static_cast<float>(std::clamp<tfloat>((v[x] - min) * scale, 0, 1)) * top + 0.5f;
+                const uint32_t q = static_cast<uint32_t>(s);
+                if (bytes_per_sample == 1)
+                {
+                    row[x] = static_cast<uint8_t>(q);
+                }
+                else
+                {
+                    row[2 * x] = static_cast<uint8_t>(q >> 8);
+                    row[2 * x + 1] = static_cast<uint8_t>(q);
+                }
+            }
+        };
+
+        std::vector<uint8_t> raw((end - begin) * (row_bytes + 1));
+        std::vector<uint8_t> previous(row_bytes, 0);
+        std::vector<uint8_t> current(row_bytes);
+        if (begin > 0)
+        {
+            sample_row(begin - 1, previous.data());
+        }
+
+        for (size_t y = begin; y < end; ++y)
+        {
+            sample_row(y, current.data());
+
+            uint8_t* out = raw.data() + (y - begin) * (row_bytes + 1);
+            out[0] = 2;
+            for (size_t i = 0; i < row_bytes; ++i)
+            {
+                out[i + 1] = static_cast<uint8_t>(current[i] - previous[i]);
+            }
+
+            std::swap(previous, current);
+        }
+
+        strip.raw_size = raw.size();
+        strip.adler = adler32(adler32(0, nullptr, 0), raw.data(), static_cast<uInt>(raw.size()));
+
+        z_stream z = {};
+        if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+
+        std::vector<uint8_t> compressed(deflateBound(&z, static_cast<uLong>(raw.size())) + 16);
+        z.next_in = raw.data();
+        z.avail_in = static_cast<uInt>(raw.size());
+        z.next_out = compressed.data();
+        z.avail_out = static_cast<uInt>(compressed.size());
+
+        const int result = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+        const bool ok = last ? result == Z_STREAM_END : result == Z_OK && z.avail_in == 0;
+        compressed.resize(compressed.size() - z.avail_out);
+        deflateEnd(&z);
+
+        strip.chunk = std::move(compressed);
+
+        return ok;
+    }
+}
+
+image_settings read_image_settings(const argh::parser& cmdl, const std::string& path)
+{
+    image_settings settings;
+    settings.format = path_extension(path) == ".png" ? image_format::png : image_format::terra;
+    cmdl("--bits", settings.bits) >> settings.bits;
+    cmdl("--png-level", settings.level) >> settings.level;
+    cmdl("--raster", settings.raster) >> settings.raster;
+
+    if (settings.bits != 8 && settings.bits != 16)
+    {
+        std::cout << "Only 8 and 16 bit images are supported, using 8" << std::endl;
+        settings.bits = 8;
+    }
+    settings.level = std::clamp(settings.level, 0, 9);
+    settings.raster = std::max<size_t>(1, settings.raster);
+
+    return settings;
+}
+
+bool write_png(scheduler& sched,
+               const std::string& path,
+               size_t width,
+               size_t height,
+               const tfloat* values,
+               tfloat min,
+               tfloat max,
+               const image_settings& settings)
+{
+    if (width == 0 || height == 0)
+    {
+        std::cout << "Unable to write an empty image to " << path << std::endl;
+        return false;
+    }
+
+    const size_t bytes_per_sample = settings.bits / 8;
+    const size_t row_bytes = width * bytes_per_sample + 1;
+    const size_t strip_rows = std::max<size_t>(1, strip_bytes / row_bytes);
+    const size_t strip_count = (height + strip_rows - 1) / strip_rows;
+    const tfloat scale = max > min ? 1 / (max - min) : 0;
+
+    std::vector<strip_t> strips(strip_count);
+    std::vector<uint8_t> failed(strip_count, 0);
+    sched.parallel_for(0, strip_count, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t s = begin; s < end; ++s)
+        {
+            const size_t first = s * strip_rows;
+            const size_t last = std::min(height, first + strip_rows);
+            failed[s] = !encode_strip(values, width, first, last, min, scale, bytes_per_sample, settings.level, s + 1 == strip_count, strips[s]);
+
+            // every strip is framed as its own IDAT, the chunks concatenate
+            // into a single zlib stream
+            if (s == 0)
+            {
+                strips[s].chunk.insert(strips[s].chunk.begin(), { 0x78, zlib_flags(settings.level) });
+            }
+            strips[s].chunk = make_chunk("IDAT", strips[s].chunk);
+        }
+    });
+
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end())
+    {
+        std::cout << "Unable to compress " << path << std::endl;
+        return false;
+    }
+
+    uLong adler = strips[0].adler;
+    for (size_t s = 1; s < strip_count; ++s)
+    {
+        adler = adler32_combine(adler, strips[s].adler, static_cast<z_off_t>(strips[s].raw_size));
+    }
+
+    std::vector<uint8_t> header;
+    put_u32(header, static_cast<uint32_t>(width));
+    put_u32(header, static_cast<uint32_t>(height));
+    header.push_back(static_cast<uint8_t>(settings.bits));
+    header.push_back(0);    // grayscale
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // no interlace
+
+    std::vector<uint8_t> trailer;
+    put_u32(trailer, static_cast<uint32_t>(adler));
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Unable to open " << path << std::endl;
+        return false;
+    }
+
+    const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    auto write = [&](const std::vector<uint8_t>& bytes)
+    {
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    };
+
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+    write(make_chunk("IHDR", header));
+    for (const auto& strip : strips)
+    {
+        write(strip.chunk);
+    }
+    write(make_chunk("IDAT", trailer));
+    write(make_chunk("IEND", {}));
+
+    if (!file)
+    {
+        std::cout << "Unable to write " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
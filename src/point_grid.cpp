@@ -0,0 +1,123 @@
+#include "point_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+point_grid::point_grid(const std::vector<terra::vec2>& points, tfloat cell_size) :
+    points(&points),
+    cell_size(cell_size),
+    min_x(0.0f),
+    min_y(0.0f),
+    columns(0),
+    rows(0)
+{
+    if (points.empty())
+    {
+        return;
+    }
+
+    tfloat max_x = points[0].x;
+    tfloat max_y = points[0].y;
+    this->min_x = points[0].x;
+    this->min_y = points[0].y;
+    for (const auto& p : points)
+    {
+        this->min_x = std::min(this->min_x, p.x);
+        this->min_y = std::min(this->min_y, p.y);
+        max_x = std::max(max_x, p.x);
+        max_y = std::max(max_y, p.y);
+    }
+
+    this->columns = static_cast<size_t>((max_x - this->min_x) / cell_size) + 1;
+    this->rows = static_cast<size_t>((max_y - this->min_y) / cell_size) + 1;
+
+    // counting sort of the points by cell
+    this->offsets.assign(this->columns * this->rows + 1, 0);
+    for (const auto& p : points)
+    {
+        ++this->offsets[this->row(p.y) * this->columns + this->column(p.x) + 1];
+    }
+    for (size_t c = 1; c < this->offsets.size(); ++c)
+    {
+        this->offsets[c] += this->offsets[c - 1];
+    }
+
+    std::vector<uint32_t> fill(this->offsets.begin(), this->offsets.end() - 1);
+    this->indices.resize(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        const size_t cell = this->row(points[i].y) * this->columns + this->column(points[i].x);
+        this->indices[fill[cell]++] = static_cast<uint32_t>(i);
+    }
+}
+
+size_t point_grid::column(tfloat x) const
+{
+    const tfloat c = std::floor((x - this->min_x) / this->cell_size);
+    return static_cast<size_t>(std::clamp(c, 0.0f, static_cast<tfloat>(this->columns - 1)));
+}
+
+size_t point_grid::row(tfloat y) const
+{
+    const tfloat r = std::floor((y - this->min_y) / this->cell_size);
+    return static_cast<size_t>(std::clamp(r, 0.0f, static_cast<tfloat>(this->rows - 1)));
+}
+
+size_t point_grid::nearest(const terra::vec2& p) const
+{
+    if (this->indices.empty())
+    {
+        return npos;
+    }
+
+    const size_t cx = this->column(p.x);
+    const size_t cy = this->row(p.y);
+
+    size_t best = npos;
+    tfloat best_d2 = std::numeric_limits<tfloat>::max();
+
+    // walk square rings of cells outwards until no closer point can exist
+    const size_t max_ring = std::max(this->columns, this->rows);
+    for (size_t ring = 0; ring <= max_ring; ++ring)
+    {
+        const size_t x0 = cx >= ring ? cx - ring : 0;
+        const size_t y0 = cy >= ring ? cy - ring : 0;
+        const size_t x1 = std::min(this->columns - 1, cx + ring);
+        const size_t y1 = std::min(this->rows - 1, cy + ring);
+
+        for (size_t y = y0; y <= y1; ++y)
+        {
+            for (size_t x = x0; x <= x1; ++x)
+            {
+                // only the cells on the edge of the ring are new
+                if (y != cy - ring && y != cy + ring && x != cx - ring && x != cx + ring)
+                {
+                    continue;
+                }
+
+                const size_t cell = y * this->columns + x;
+                for (uint32_t i = this->offsets[cell]; i < this->offsets[cell + 1]; ++i)
+                {
+                    const auto& q = (*this->points)[this->indices[i]];
+                    const tfloat dx = q.x - p.x;
+                    const tfloat dy = q.y - p.y;
+                    const tfloat d2 = dx * dx + dy * dy;
+                    if (d2 < best_d2)
+                    {
+                        best_d2 = d2;
+                        best = this->indices[i];
+                    }
+                }
+            }
+        }
+
+        // every point outside this ring is at least `ring` cells away
+        const tfloat reach = static_cast<tfloat>(ring) * this->cell_size;
+        if (best != npos && best_d2 <= reach * reach)
+        {
+            break;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,164 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+profile::profile(bool enabled, bool counters) : enabled(enabled)
+{
+    if (enabled)
+    {
+        count_heap_allocations();
+    }
+
+    if (enabled && counters)
+    {
+        this->counters = std::make_unique<perf_counters>();
+        if (!this->counters->any_available())
+        {
+            this->note("Hardware counters unavailable (" + this->counters->error() + ")");
+            this->counters.reset();
+        }
+    }
+}
+
+profile::scope::scope(profile& prof, const std::string& name) :
+    prof(prof),
+    name(name),
+    start(std::chrono::steady_clock::now()),
+    start_counts(heap_allocations()),
+    start_counters(),
+    itterations(0),
+    nodes(0)
+{
+    // read last so the stage does not count its own bookkeeping
+    if (prof.counters)
+    {
+        this->start_counters = prof.counters->read();
+    }
+}
+
+profile::scope::~scope()
+{
+    if (!this->prof.enabled)
+    {
+        return;
+    }
+
+    perf_counters::values_t counters = {};
+    if (this->prof.counters)
+    {
+        counters = this->prof.counters->read();
+        for (size_t c = 0; c < counters.size(); ++c)
+        {
+            counters[c] -= this->start_counters[c];
+        }
+    }
+
+    const auto counts = heap_allocations();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - this->start;
+
+    this->prof.stages.push_back({ this->name,
+                                  elapsed.count(),
+                                  counts.allocations - this->start_counts.allocations,
+                                  counts.bytes - this->start_counts.bytes,
+                                  this->itterations,
+                                  this->nodes,
+                                  counters });
+}
+
+void profile::note(const std::string& line)
+{
+    if (this->enabled)
+    {
+        this->notes.push_back(line);
+    }
+}
+
+void profile::print(std::ostream& out) const
+{
+    if (!this->enabled)
+    {
+        return;
+    }
+
+    out << std::endl << "Profile" << std::endl;
+    out << std::left
+        << std::setw(20) << "stage"
+        << std::setw(12) << "time(s)"
+        << std::setw(14) << "allocations"
+        << std::setw(16) << "bytes"
+        << "allocations/iter" << std::endl;
+
+    for (const auto& stage : this->stages)
+    {
+        out << std::left << std::fixed << std::setprecision(3)
+            << std::setw(20) << stage.name
+            << std::setw(12) << stage.seconds
+            << std::setw(14) << stage.allocations
+            << std::setw(16) << stage.bytes;
+        if (stage.itterations > 0)
+        {
+            out << std::setprecision(1) << static_cast<double>(stage.allocations) / static_cast<double>(stage.itterations);
+        }
+        out << std::endl;
+    }
+
+    this->print_counters(out);
+
+    for (const auto& line : this->notes)
+    {
+        out << line << std::endl;
+    }
+}
+
+void profile::print_counters(std::ostream& out) const
+{
+    if (!this->counters)
+    {
+        return;
+    }
+
+    const auto& pc = *this->counters;
+
+    out << std::endl << "Counters, per node and iteration" << std::endl;
+    out << std::left << std::setw(20) << "stage" << std::setw(8) << "IPC";
+    for (const auto c : { perf_counters::cycles, perf_counters::llc_misses, perf_counters::branch_misses, perf_counters::dtlb_misses })
+    {
+        out << std::setw(16) << perf_counters::name(c);
+    }
+    out << std::endl;
+
+    for (const auto& stage : this->stages)
+    {
+        const auto& v = stage.counters;
+        const double per = static_cast<double>(std::max<size_t>(stage.nodes, 1) * std::max<size_t>(stage.itterations, 1));
+
+        out << std::left << std::fixed << std::setprecision(2) << std::setw(20) << stage.name;
+        if (pc.available(perf_counters::cycles) && pc.available(perf_counters::instructions) && v[perf_counters::cycles] > 0.0)
+        {
+            out << std::setw(8) << v[perf_counters::instructions] / v[perf_counters::cycles];
+        }
+        else
+        {
+            out << std::setw(8) << "n/a";
+        }
+
+        for (const auto c : { perf_counters::cycles, perf_counters::llc_misses, perf_counters::branch_misses, perf_counters::dtlb_misses })
+        {
+            if (pc.available(c) && stage.nodes > 0)
+            {
+                out << std::setw(16) << std::setprecision(3) << v[c] / per;
+            }
+            else
+            {
+                out << std::setw(16) << "n/a";
+            }
+        }
+        out << std::endl;
+    }
+
+    if (!pc.error().empty())
+    {
+        out << "Some counters are unavailable (" << pc.error() << ")" << std::endl;
+    }
+}
@@ -0,0 +1,484 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    typedef std::chrono::steady_clock scheduler_clock;
+
+    thread_local const scheduler* current_scheduler = nullptr;
+    thread_local size_t current_worker = 0;
+
+    // Parses a kernel cpu list such as "0-3,8-11".
+    std::vector<int> parse_cpu_list(const std::string& list)
+    {
+        std::vector<int> cpus;
+        std::istringstream ranges(list);
+        std::string range;
+        while (std::getline(ranges, range, ','))
+        {
+            const auto dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        return cpus;
+    }
+
+    // One list of cpus per NUMA node, or a single node holding every cpu
+    // when the topology is not exposed.
+    std::vector<std::vector<int>> numa_nodes()
+    {
+        std::vector<std::vector<int>> nodes;
+
+        const std::filesystem::path root = "/sys/devices/system/node";
+        std::error_code error;
+        for (size_t node = 0; std::filesystem::exists(root / ("node" + std::to_string(node)), error); ++node)
+        {
+            std::ifstream file(root / ("node" + std::to_string(node)) / "cpulist");
+            std::string list;
+            if (std::getline(file, list) && !list.empty())
+            {
+                nodes.push_back(parse_cpu_list(list));
+            }
+        }
+
+        if (nodes.empty())
+        {
+            std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+            for (size_t i = 0; i < cpus.size(); ++i)
+            {
+                cpus[i] = static_cast<int>(i);
+            }
+            nodes.push_back(cpus);
+        }
+
+        return nodes;
+    }
+
+    // The order in which workers are assigned to cpus.
+    std::vector<int> placement_order(affinity_policy affinity)
+    {
+        const auto nodes = numa_nodes();
+
+        std::vector<int> order;
+        if (affinity == affinity_policy::compact)
+        {
+            for (const auto& node : nodes)
+            {
+                order.insert(order.end(), node.begin(), node.end());
+            }
+        }
+        else
+        {
+            size_t longest = 0;
+            for (const auto& node : nodes)
+            {
+                longest = std::max(longest, node.size());
+            }
+
+            for (size_t i = 0; i < longest; ++i)
+            {
+                for (const auto& node : nodes)
+                {
+                    if (i < node.size())
+                    {
+                        order.push_back(node[i]);
+                    }
+                }
+            }
+        }
+
+        return order;
+    }
+
+    bool pin_thread(std::thread& thread, int cpu)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &set) == 0;
+#else
+        (void)thread;
+        (void)cpu;
+
+        return false;
+#endif
+    }
+}
+
+scheduler::scheduler(size_t threads, affinity_policy affinity) : pending(0), stopping(false)
+{
+    if (threads == 0)
+    {
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    // every worker exists before any of them starts stealing
+    this->workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        this->workers.push_back(std::make_unique<worker_t>());
+    }
+
+    const auto order = affinity == affinity_policy::none ? std::vector<int>() : placement_order(affinity);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        auto& worker = *this->workers[i];
+        worker.thread = std::thread(&scheduler::run, this, i);
+
+        if (!order.empty())
+        {
+            const int cpu = order[i % order.size()];
+            if (pin_thread(worker.thread, cpu))
+            {
+                worker.cpu = cpu;
+            }
+            else if (i == 0)
+            {
+                std::cout << "Unable to pin scheduler workers, continuing without affinity" << std::endl;
+            }
+        }
+    }
+}
+
+scheduler::~scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+
+    for (auto& worker : this->workers)
+    {
+        worker->thread.join();
+    }
+}
+
+size_t scheduler::chunk_size(size_t begin, size_t end, size_t grain) const
+{
+    if (end <= begin)
+    {
+        return 0;
+    }
+
+    // a few chunks per worker leaves room to balance uneven chunks
+    const size_t target = std::max<size_t>(1, this->workers.size() * 4);
+    return std::max<size_t>(std::max<size_t>(1, grain), (end - begin + target - 1) / target);
+}
+
+void scheduler::task_queue::push_back(task_t task)
+{
+    if (this->count == this->ring.size())
+    {
+        std::vector<task_t> grown(std::max<size_t>(64, this->ring.size() * 2));
+        for (size_t i = 0; i < this->count; ++i)
+        {
+            grown[i] = std::move(this->ring[(this->head + i) % this->ring.size()]);
+        }
+
+        this->ring = std::move(grown);
+        this->head = 0;
+    }
+
+    this->ring[(this->head + this->count) % this->ring.size()] = std::move(task);
+    ++this->count;
+}
+
+bool scheduler::task_queue::pop_back(task_t& task)
+{
+    if (this->count == 0)
+    {
+        return false;
+    }
+
+    --this->count;
+    task = std::move(this->ring[(this->head + this->count) % this->ring.size()]);
+
+    return true;
+}
+
+bool scheduler::task_queue::pop_front(task_t& task)
+{
+    if (this->count == 0)
+    {
+        return false;
+    }
+
+    task = std::move(this->ring[this->head]);
+    this->head = (this->head + 1) % this->ring.size();
+    --this->count;
+
+    return true;
+}
+
+scheduler::loop_t* scheduler::acquire_loop()
+{
+    std::lock_guard<std::mutex> lock(this->loops_mutex);
+    if (this->free_loops.empty())
+    {
+        this->loops.push_back(std::make_unique<loop_t>());
+        this->free_loops.reserve(this->loops.size());
+
+        return this->loops.back().get();
+    }
+
+    auto loop = this->free_loops.back();
+    this->free_loops.pop_back();
+
+    return loop;
+}
+
+void scheduler::release_loop(loop_t* loop)
+{
+    if (--loop->refs == 0)
+    {
+        std::lock_guard<std::mutex> lock(this->loops_mutex);
+        this->free_loops.push_back(loop);
+    }
+}
+
+void scheduler::work_loop(loop_t& loop)
+{
+    // a helper that starts after every chunk was claimed returns without
+    // touching the body, which may be gone by then
+    for (size_t i = loop.next++; i < loop.chunks; i = loop.next++)
+    {
+        const size_t b = loop.begin + i * loop.chunk;
+        try
+        {
+            loop.call(loop.body, b, std::min(loop.end, b + loop.chunk));
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(loop.error_mutex);
+            if (!loop.error)
+            {
+                loop.error = std::current_exception();
+            }
+        }
+        ++loop.done;
+    }
+}
+
+void scheduler::run_loop(size_t begin, size_t end, size_t grain, const void* body, call_t call)
+{
+    const size_t chunk = this->chunk_size(begin, end, grain);
+    if (chunk == 0)
+    {
+        return;
+    }
+
+    const size_t chunks = (end - begin + chunk - 1) / chunk;
+    if (chunks == 1)
+    {
+        call(body, begin, end);
+        return;
+    }
+
+    const size_t helpers = std::min(this->workers.size(), chunks - 1);
+
+    auto loop = this->acquire_loop();
+    loop->body = body;
+    loop->call = call;
+    loop->begin = begin;
+    loop->end = end;
+    loop->chunk = chunk;
+    loop->chunks = chunks;
+    loop->next = 0;
+    loop->done = 0;
+    loop->refs = helpers + 1;
+    loop->error = nullptr;
+
+    // two pointers fit in the small buffer of std::function
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        this->push([this, loop]()
+        {
+            this->work_loop(*loop);
+            this->release_loop(loop);
+        });
+    }
+
+    this->work_loop(*loop);
+    while (loop->done < chunks)
+    {
+        std::this_thread::yield();
+    }
+
+    auto error = loop->error;
+    this->release_loop(loop);
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void scheduler::push(task_t task)
+{
+    if (current_scheduler == this)
+    {
+        auto& worker = *this->workers[current_worker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(this->injected_mutex);
+        this->injected.push_back(std::move(task));
+    }
+
+    ++this->pending;
+    {
+        // taking the lock orders the wake up after a sleeping worker's check
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+    }
+    this->wake.notify_one();
+}
+
+bool scheduler::pop(size_t index, task_t& task)
+{
+    auto& self = *this->workers[index];
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (self.tasks.pop_back(task))
+        {
+            --this->pending;
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->injected_mutex);
+        if (this->injected.pop_front(task))
+        {
+            --this->pending;
+            return true;
+        }
+    }
+
+    const size_t count = this->workers.size();
+    for (size_t offset = 1; offset < count; ++offset)
+    {
+        auto& victim = *this->workers[(index + offset) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.pop_front(task))
+        {
+            --this->pending;
+            ++self.steals;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void scheduler::run(size_t index)
+{
+    current_scheduler = this;
+    current_worker = index;
+
+    auto& self = *this->workers[index];
+    while (true)
+    {
+        task_t task;
+        if (this->pop(index, task))
+        {
+            task();
+            ++self.executed;
+            continue;
+        }
+
+        const auto idle_start = scheduler_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(this->sleep_mutex);
+            this->wake.wait(lock, [this]() { return this->stopping || this->pending > 0; });
+
+            // drain the queues before stopping so no submitted future is left unresolved
+            if (this->stopping && this->pending == 0)
+            {
+                return;
+            }
+        }
+        self.idle_ns += static_cast<size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(scheduler_clock::now() - idle_start).count());
+    }
+}
+
+void scheduler::print_stats(std::ostream& out) const
+{
+    out << "Scheduler statistics" << std::endl;
+    out << std::left
+        << std::setw(8)  << "worker"
+        << std::setw(6)  << "cpu"
+        << std::setw(12) << "tasks"
+        << std::setw(10) << "steals"
+        << "idle(s)" << std::endl;
+
+    for (size_t i = 0; i < this->workers.size(); ++i)
+    {
+        const auto& worker = *this->workers[i];
+        out << std::left << std::fixed << std::setprecision(3)
+            << std::setw(8)  << i
+            << std::setw(6)  << (worker.cpu < 0 ? std::string("-") : std::to_string(worker.cpu))
+            << std::setw(12) << worker.executed.load()
+            << std::setw(10) << worker.steals.load()
+            << static_cast<double>(worker.idle_ns.load()) * 1e-9 << std::endl;
+    }
+}
+
+bool parse_affinity(const std::string& name, affinity_policy& affinity)
+{
+    if (name == "none")
+    {
+        affinity = affinity_policy::none;
+    }
+    else if (name == "compact")
+    {
+        affinity = affinity_policy::compact;
+    }
+    else if (name == "scatter")
+    {
+        affinity = affinity_policy::scatter;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<scheduler> make_scheduler(const argh::parser& cmdl)
+{
+    size_t threads = 0;
+    std::string affinity_name;
+    cmdl("--threads", 0) >> threads;
+    cmdl("--affinity", "none") >> affinity_name;
+
+    affinity_policy affinity = affinity_policy::none;
+    if (!parse_affinity(affinity_name, affinity))
+    {
+        std::cout << "Unknown affinity \"" << affinity_name << "\", expected none, compact or scatter" << std::endl;
+    }
+
+    return std::make_unique<scheduler>(threads, affinity);
+}
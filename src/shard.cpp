@@ -0,0 +1,863 @@
+#include "shard.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "png_writer.hpp"
+#include "point_grid.hpp"
+#include "profile.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#ifdef __linux__
+namespace
+{
+    const uint64_t segment_magic = 0x70726d72646c0001;
+    const size_t segment_align = 64;
+
+    enum shard_state : uint32_t
+    {
+        shard_running,
+        shard_done,
+        shard_failed
+    };
+
+    // The lstgtufe settings a shard runs with. Parent and shards run the
+    // same binary so they can be shared as they are, as long as they stay
+    // free of pointers.
+    struct shard_settings
+    {
+        size_t width;
+        size_t height;
+        float radius;
+        size_t samples;
+        float uplift_per_year;
+        float erosion_rate;
+        float time_scale;
+        size_t max_itterations;
+    };
+
+    static_assert(std::is_trivially_copyable_v<shard_settings>, "shard settings live in shared memory");
+
+    shard_settings make_shard_settings(const lstgtufe_settings& settings)
+    {
+        return { settings.width,
+                 settings.height,
+                 settings.radius,
+                 settings.samples,
+                 settings.uplift_per_year,
+                 settings.erosion_rate,
+                 settings.time_scale,
+                 settings.max_itterations };
+    }
+
+    // Start of the shared segment.
+    struct segment_header
+    {
+        uint64_t magic;
+        uint32_t shards;
+        uint32_t raster_size;
+        uint64_t overlap;
+        shard_settings settings;
+
+        std::atomic<uint32_t> arrived;
+        std::atomic<uint32_t> generation;
+        std::atomic<uint32_t> abort;
+    };
+
+    struct shard_status
+    {
+        std::atomic<uint32_t> state;
+        std::atomic<uint32_t> changed[2];
+        uint32_t itterations;
+    };
+
+    // The band around the seam between strip b and strip b + 1. Everything
+    // written during an iteration is double buffered by its parity, so a
+    // single barrier per iteration keeps readers and writers apart.
+    struct band_view
+    {
+        size_t count = 0;
+        terra::vec2* points = nullptr;
+        tfloat* heights[2] = {};
+
+        // drainage routed into the band by strip b + 1, read by strip b
+        tfloat* into_left[2] = {};
+
+        // drainage routed into the band by strip b, read by strip b + 1
+        tfloat* into_right[2] = {};
+    };
+
+    struct segment_view
+    {
+        segment_header* header = nullptr;
+        uint64_t* band_counts = nullptr;
+        shard_status* status = nullptr;
+        std::vector<band_view> bands;
+        tfloat* raster = nullptr;
+    };
+
+    size_t align_up(size_t value)
+    {
+        return (value + segment_align - 1) / segment_align * segment_align;
+    }
+
+    // Lays the segment out behind `base` and returns its size, a null base
+    // only measures it.
+    size_t layout_segment(std::byte* base, size_t shards, size_t raster_size, const uint64_t* band_counts, segment_view& view)
+    {
+        size_t offset = 0;
+        auto place = [&](size_t bytes)
+        {
+            const size_t at = offset;
+            offset = align_up(offset + bytes);
+            return base ? base + at : nullptr;
+        };
+
+        view.header = reinterpret_cast<segment_header*>(place(sizeof(segment_header)));
+        view.band_counts = reinterpret_cast<uint64_t*>(place(sizeof(uint64_t) * (shards - 1)));
+        view.status = reinterpret_cast<shard_status*>(place(sizeof(shard_status) * shards));
+
+        // shards pass no counts and read them back from the segment
+        const uint64_t* counts = band_counts ? band_counts : view.band_counts;
+
+        view.bands.assign(shards - 1, band_view());
+        for (size_t b = 0; b + 1 < shards; ++b)
+        {
+            auto& band = view.bands[b];
+            band.count = counts[b];
+            band.points = reinterpret_cast<terra::vec2*>(place(sizeof(terra::vec2) * band.count));
+            for (size_t p = 0; p < 2; ++p)
+            {
+                band.heights[p] = reinterpret_cast<tfloat*>(place(sizeof(tfloat) * band.count));
+                band.into_left[p] = reinterpret_cast<tfloat*>(place(sizeof(tfloat) * band.count));
+                band.into_right[p] = reinterpret_cast<tfloat*>(place(sizeof(tfloat) * band.count));
+            }
+        }
+
+        view.raster = reinterpret_cast<tfloat*>(place(sizeof(tfloat) * raster_size * raster_size));
+
+        return offset;
+    }
+
+    // Sense reversing barrier over every shard process.
+    void barrier(segment_header& header)
+    {
+        const uint32_t generation = header.generation.load();
+        if (header.arrived.fetch_add(1) + 1 == header.shards)
+        {
+            header.arrived = 0;
+            ++header.generation;
+            return;
+        }
+
+        for (size_t spins = 0; header.generation.load() == generation; ++spins)
+        {
+            if (header.abort.load())
+            {
+                throw std::runtime_error("another shard failed");
+            }
+
+            if (spins < 1024)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    // x positions of the strips, strip s owns [seam(s - 1), seam(s)) and
+    // meshes [seam(s - 1) - overlap, seam(s) + overlap).
+    struct strip_bounds
+    {
+        size_t begin;
+        size_t end;
+        size_t lo;
+        size_t hi;
+    };
+
+    size_t seam_of(const shard_settings& settings, size_t shards, size_t b)
+    {
+        return settings.width * (b + 1) / shards;
+    }
+
+    strip_bounds strip_of(const shard_settings& settings, size_t shards, size_t overlap, size_t s)
+    {
+        strip_bounds strip;
+        strip.begin = s == 0 ? 0 : seam_of(settings, shards, s - 1);
+        strip.end = s + 1 == shards ? settings.width : seam_of(settings, shards, s);
+        strip.lo = s == 0 ? 0 : strip.begin - overlap;
+        strip.hi = s + 1 == shards ? settings.width : strip.end + overlap;
+
+        return strip;
+    }
+
+    std::vector<terra::vec2> sample_region(size_t x, size_t width, size_t height, float radius, size_t samples)
+    {
+        terra::hash_grid* grid = nullptr;
+        auto sampler = terra::poisson_disc_sampler();
+        auto points = sampler.sample(width, height, radius, samples, &grid);
+        delete grid;
+
+        for (auto& p : points)
+        {
+            p.x += static_cast<tfloat>(x);
+        }
+
+        return points;
+    }
+
+    // The strip's own points followed by the band points it shares with its
+    // neighbours. Core points that landed closer than the sampling radius to
+    // a band point are dropped to keep the disc property across the seam.
+    struct strip_points
+    {
+        std::vector<terra::vec2> points;
+        size_t left_count = 0;
+        size_t right_offset = 0;
+    };
+
+    strip_points gather_points(const segment_view& view, size_t s)
+    {
+        const auto& header = *view.header;
+        const auto& settings = header.settings;
+        const size_t shards = header.shards;
+        const auto strip = strip_of(settings, shards, header.overlap, s);
+
+        const size_t core_lo = s == 0 ? 0 : strip.begin + header.overlap;
+        const size_t core_hi = s + 1 == shards ? settings.width : strip.end - header.overlap;
+        auto core = sample_region(core_lo, core_hi - core_lo, settings.height, settings.radius, settings.samples);
+
+        std::vector<terra::vec2> band_points;
+        if (s > 0)
+        {
+            const auto& band = view.bands[s - 1];
+            band_points.insert(band_points.end(), band.points, band.points + band.count);
+        }
+        const size_t left_count = band_points.size();
+        if (s + 1 < shards)
+        {
+            const auto& band = view.bands[s];
+            band_points.insert(band_points.end(), band.points, band.points + band.count);
+        }
+
+        strip_points result;
+        result.points.reserve(core.size() + band_points.size());
+        result.points.insert(result.points.end(), band_points.begin(), band_points.begin() + left_count);
+        result.left_count = left_count;
+
+        const point_grid grid(band_points, settings.radius);
+        for (const auto& p : core)
+        {
+            bool crowded = false;
+            grid.for_each_within(p, settings.radius, [&](size_t) { crowded = true; });
+            if (!crowded)
+            {
+                result.points.push_back(p);
+            }
+        }
+
+        result.right_offset = result.points.size();
+        result.points.insert(result.points.end(), band_points.begin() + left_count, band_points.end());
+
+        // the mesh works in strip local coordinates
+        for (auto& p : result.points)
+        {
+            p.x -= static_cast<tfloat>(strip.lo);
+        }
+
+        return result;
+    }
+
+    // Buffers of route_drainage, sized once per strip.
+    struct drainage_routing
+    {
+        explicit drainage_routing(size_t node_count) :
+            receivers(node_count),
+            donor_offsets(node_count + 1),
+            donors(node_count),
+            order(node_count),
+            drainage(node_count)
+        {
+        }
+
+        std::vector<uint32_t> receivers;
+
+        // donors of node i are donors[donor_offsets[i]] .. donors[donor_offsets[i + 1]]
+        std::vector<uint32_t> donor_offsets;
+        std::vector<uint32_t> donors;
+
+        // every node comes after its receiver
+        std::vector<uint32_t> order;
+        std::vector<tfloat> drainage;
+    };
+
+    // Steepest descent receivers and the drainage area accumulated over
+    // them. terra's flow_graph keeps its receivers to itself, so the drainage
+    // handed to the neighbours is routed here over the same mesh.
+    void route_drainage(const lstgtufe_mesh& mesh,
+                        const terra::dynarray<tfloat>& heights,
+                        const terra::dynarray<tfloat>& areas,
+                        drainage_routing& routing)
+    {
+        const size_t node_count = mesh.points.size();
+        const auto& adjacency = mesh.adjacency;
+        auto& receivers = routing.receivers;
+        auto& donor_offsets = routing.donor_offsets;
+        auto& donors = routing.donors;
+        auto& order = routing.order;
+        auto& drainage = routing.drainage;
+
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            uint32_t receiver = static_cast<uint32_t>(i);
+            tfloat steepest = 0.0f;
+            for (uint32_t e = adjacency.offsets[i]; e < adjacency.offsets[i + 1]; ++e)
+            {
+                const uint32_t j = adjacency.neighbours[e];
+                const tfloat dx = mesh.points[j].x - mesh.points[i].x;
+                const tfloat dy = mesh.points[j].y - mesh.points[i].y;
+                const tfloat slope = (heights[i] - heights[j]) / std::sqrt(dx * dx + dy * dy);
+                if (slope > steepest)
+                {
+                    steepest = slope;
+                    receiver = j;
+                }
+            }
+
+            receivers[i] = receiver;
+            drainage[i] = areas[i];
+        }
+
+        // counting sort of the nodes by receiver
+        std::fill(donor_offsets.begin(), donor_offsets.end(), 0u);
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            if (receivers[i] != i)
+            {
+                ++donor_offsets[receivers[i] + 1];
+            }
+        }
+        for (size_t i = 1; i <= node_count; ++i)
+        {
+            donor_offsets[i] += donor_offsets[i - 1];
+        }
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            if (receivers[i] != i)
+            {
+                donors[donor_offsets[receivers[i]]++] = static_cast<uint32_t>(i);
+            }
+        }
+        // the fill moved every offset up by one row
+        for (size_t i = node_count; i > 0; --i)
+        {
+            donor_offsets[i] = donor_offsets[i - 1];
+        }
+        donor_offsets[0] = 0;
+
+        // breadth first from the nodes that drain nowhere, receivers are
+        // strictly lower so every node is reached exactly once
+        size_t count = 0;
+        for (size_t i = 0; i < node_count; ++i)
+        {
+            if (receivers[i] == i)
+            {
+                order[count++] = static_cast<uint32_t>(i);
+            }
+        }
+        for (size_t head = 0; head < count; ++head)
+        {
+            const uint32_t i = order[head];
+            for (uint32_t d = donor_offsets[i]; d < donor_offsets[i + 1]; ++d)
+            {
+                order[count++] = donors[d];
+            }
+        }
+
+        // upstream first so every node is complete before it drains on
+        for (size_t k = node_count; k > 0; --k)
+        {
+            const uint32_t i = order[k - 1];
+            if (receivers[i] != i)
+            {
+                drainage[receivers[i]] += drainage[i];
+            }
+        }
+    }
+
+    size_t run_strip(scheduler& sched, segment_view& view, size_t s)
+    {
+        auto& header = *view.header;
+        const auto& settings = header.settings;
+        const size_t shards = header.shards;
+        const auto strip = strip_of(settings, shards, header.overlap, s);
+
+        auto gathered = gather_points(view, s);
+        const size_t left_count = gathered.left_count;
+        const size_t right_offset = gathered.right_offset;
+
+        // drainage is routed over the mesh's own neighbour lists
+        mesh_storage storage;
+        storage.neighbours = true;
+
+        profile prof;
+        const lstgtufe_mesh mesh(sched, prof, strip.hi - strip.lo, settings.height, settings.radius, std::move(gathered.points), {}, storage);
+        const size_t node_count = mesh.points.size();
+
+        // uplift is a function of the position in the whole domain
+        std::vector<terra::vec2> global_points(mesh.points);
+        for (auto& p : global_points)
+        {
+            p.x += static_cast<tfloat>(strip.lo);
+        }
+
+        const tfloat uplift_factor = settings.uplift_per_year * settings.time_scale;
+        const tfloat k = settings.erosion_rate * settings.time_scale;
+
+        terra::dynarray<tfloat> heights(node_count);
+        std::fill(heights.begin(), heights.end(), 0.0f);
+        std::vector<tfloat> heights_old(node_count);
+
+        // the cell areas plus the drainage the neighbours route into the bands
+        terra::dynarray<tfloat> areas(node_count);
+        std::copy(mesh.areas.begin(), mesh.areas.end(), areas.begin());
+
+        terra::linear_uplift uplift_func(settings.width, settings.height, 0.01, 1.0);
+        terra::uplift uplift(uplift_func, global_points, heights, uplift_factor);
+        terra::flow_graph flow_graph(node_count, mesh.graph, areas, heights);
+
+        terra::stream_power_equation fluvial_erosion(k, settings.time_scale, mesh.points, flow_graph, areas, uplift.uplifts, heights);
+        terra::thermal_erosion thermal_erosion(mesh.points, heights, mesh.graph, 40.0);
+
+        const tfloat seam_left = static_cast<tfloat>(strip.begin - strip.lo);
+        const tfloat seam_right = static_cast<tfloat>(strip.end - strip.lo);
+        auto owned = [&](size_t i)
+        {
+            return mesh.points[i].x >= seam_left && (s + 1 == shards || mesh.points[i].x < seam_right);
+        };
+
+        drainage_routing routing(node_count);
+        const auto& receivers = routing.receivers;
+        const auto& drainage = routing.drainage;
+
+        band_view* left = s > 0 ? &view.bands[s - 1] : nullptr;
+        band_view* right = s + 1 < shards ? &view.bands[s] : nullptr;
+
+        size_t itterations = 0;
+        bool changed = false;
+        do
+        {
+            std::copy(heights.begin(), heights.end(), heights_old.begin());
+
+            flow_graph.update();
+            fluvial_erosion.update();
+            thermal_erosion.update();
+
+            const size_t p = itterations & 1;
+
+            changed = false;
+            for (size_t i = 0; i < node_count && !changed; ++i)
+            {
+                changed = owned(i) && terra::math::abs(heights[i] - heights_old[i]) > terrain_epsilon;
+            }
+            view.status[s].changed[p] = changed ? 1 : 0;
+
+            // publish the owned band heights and the drainage that leaves
+            // through the bands towards nodes the neighbours do not mesh
+            route_drainage(mesh, heights, areas, routing);
+            if (left)
+            {
+                std::fill(left->into_left[p], left->into_left[p] + left->count, 0.0f);
+                for (size_t i = 0; i < left->count; ++i)
+                {
+                    if (owned(i))
+                    {
+                        left->heights[p][i] = heights[i];
+                    }
+                }
+            }
+            if (right)
+            {
+                std::fill(right->into_right[p], right->into_right[p] + right->count, 0.0f);
+                for (size_t i = 0; i < right->count; ++i)
+                {
+                    if (owned(right_offset + i))
+                    {
+                        right->heights[p][i] = heights[right_offset + i];
+                    }
+                }
+            }
+            for (size_t i = 0; i < node_count; ++i)
+            {
+                const size_t r = receivers[i];
+                if (left && i >= left_count && r < left_count)
+                {
+                    left->into_left[p][r] += drainage[i];
+                }
+                if (right && i < right_offset && r >= right_offset)
+                {
+                    right->into_right[p][r - right_offset] += drainage[i];
+                }
+            }
+
+            barrier(header);
+
+            // take the neighbour owned band heights and inflows
+            if (left)
+            {
+                for (size_t i = 0; i < left->count; ++i)
+                {
+                    if (!owned(i))
+                    {
+                        heights[i] = left->heights[p][i];
+                    }
+                    areas[i] = mesh.areas[i] + left->into_right[p][i];
+                }
+            }
+            if (right)
+            {
+                for (size_t i = 0; i < right->count; ++i)
+                {
+                    if (!owned(right_offset + i))
+                    {
+                        heights[right_offset + i] = right->heights[p][i];
+                    }
+                    areas[right_offset + i] = mesh.areas[right_offset + i] + right->into_left[p][i];
+                }
+            }
+
+            changed = false;
+            for (size_t t = 0; t < shards; ++t)
+            {
+                changed = changed || view.status[t].changed[p] != 0;
+            }
+        }
+        while (changed && (++itterations) < settings.max_itterations);
+
+        // every strip rasters the columns it owns
+        const size_t raster_size = header.raster_size;
+        const point_grid grid(mesh.points, settings.radius);
+        const tfloat scale_x = static_cast<tfloat>(settings.width) / raster_size;
+        const tfloat scale_y = static_cast<tfloat>(settings.height) / raster_size;
+        sched.parallel_for(0, raster_size, 16, [&](size_t row_begin, size_t row_end)
+        {
+            for (size_t y = row_begin; y < row_end; ++y)
+            {
+                for (size_t x = 0; x < raster_size; ++x)
+                {
+                    const tfloat gx = (static_cast<tfloat>(x) + 0.5f) * scale_x;
+                    if (gx < static_cast<tfloat>(strip.begin) || gx >= static_cast<tfloat>(strip.end))
+                    {
+                        continue;
+                    }
+
+                    const terra::vec2 p = { gx - static_cast<tfloat>(strip.lo), (static_cast<tfloat>(y) + 0.5f) * scale_y };
+                    const size_t nearest = grid.nearest(p);
+                    view.raster[y * raster_size + x] = nearest == point_grid::npos ? 0.0f : heights[nearest];
+                }
+            }
+        });
+
+        return itterations;
+    }
+
+    class shared_segment
+    {
+    public:
+        shared_segment(const std::string& name, size_t size, bool create) : name(name), size(size), owner(create), base(nullptr)
+        {
+            const int fd = shm_open(name.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+            if (fd < 0)
+            {
+                throw std::runtime_error("unable to open shared memory " + name);
+            }
+
+            if (create && ftruncate(fd, static_cast<off_t>(size)) != 0)
+            {
+                close(fd);
+                shm_unlink(name.c_str());
+                throw std::runtime_error("unable to size shared memory " + name);
+            }
+
+            if (!create)
+            {
+                struct stat info;
+                fstat(fd, &info);
+                this->size = static_cast<size_t>(info.st_size);
+            }
+
+            void* mapped = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED)
+            {
+                if (create)
+                {
+                    shm_unlink(name.c_str());
+                }
+                throw std::runtime_error("unable to map shared memory " + name);
+            }
+
+            this->base = static_cast<std::byte*>(mapped);
+        }
+
+        ~shared_segment()
+        {
+            munmap(this->base, this->size);
+            if (this->owner)
+            {
+                shm_unlink(this->name.c_str());
+            }
+        }
+
+        shared_segment(const shared_segment&) = delete;
+        shared_segment& operator=(const shared_segment&) = delete;
+
+        std::byte* data() const
+        {
+            return this->base;
+        }
+
+    private:
+        std::string name;
+        size_t size;
+        bool owner;
+        std::byte* base;
+    };
+}
+
+bool lstgtufe_sharded(const argh::parser& cmdl,
+                      const output& out,
+                      scheduler& sched,
+                      const lstgtufe_settings& settings,
+                      size_t shards)
+{
+    // shards build and erode their strips on their own, with none of the
+    // options below
+    for (const auto* flag : { "adaptive", "reorder" })
+    {
+        if (cmdl[flag] || cmdl(flag))
+        {
+            std::cout << "Sharded runs do not support --" << flag << std::endl;
+            return false;
+        }
+    }
+    for (const auto* param : { "storage", "warm-start", "save-state", "density", "ensemble" })
+    {
+        if (cmdl(param))
+        {
+            std::cout << "Sharded runs do not support --" << param << std::endl;
+            return false;
+        }
+    }
+
+    if (out.type != output_type::heightfield)
+    {
+        std::cout << "Sharded runs only write heightfields" << std::endl;
+        return false;
+    }
+
+    const size_t raster_size = out.image.raster;
+    if (raster_size == 0)
+    {
+        return false;
+    }
+
+    size_t overlap = 0;
+    cmdl("--overlap", static_cast<size_t>(std::ceil(8.0f * settings.radius))) >> overlap;
+
+    // every strip needs a core of its own between its two bands
+    const size_t strip_width = settings.width / shards;
+    if (strip_width <= 2 * overlap + static_cast<size_t>(2.0f * settings.radius))
+    {
+        std::cout << "Strips of " << strip_width << " are too narrow for an overlap of " << overlap
+                  << ", use fewer shards or a smaller --overlap" << std::endl;
+        return false;
+    }
+
+    std::vector<std::vector<terra::vec2>> bands(shards - 1);
+    std::vector<uint64_t> band_counts(shards - 1);
+    for (size_t b = 0; b + 1 < shards; ++b)
+    {
+        const size_t seam = seam_of(make_shard_settings(settings), shards, b);
+        bands[b] = sample_region(seam - overlap, 2 * overlap, settings.height, settings.radius, settings.samples);
+        band_counts[b] = bands[b].size();
+    }
+
+    segment_view view;
+    const size_t size = layout_segment(nullptr, shards, raster_size, band_counts.data(), view);
+    const std::string name = "/prmrdl-shard-" + std::to_string(getpid());
+    shared_segment segment(name, size, true);
+    layout_segment(segment.data(), shards, raster_size, band_counts.data(), view);
+
+    auto& header = *new (view.header) segment_header();
+    header.magic = segment_magic;
+    header.shards = static_cast<uint32_t>(shards);
+    header.raster_size = static_cast<uint32_t>(raster_size);
+    header.overlap = overlap;
+    header.settings = make_shard_settings(settings);
+    std::copy(band_counts.begin(), band_counts.end(), view.band_counts);
+    for (size_t s = 0; s < shards; ++s)
+    {
+        new (&view.status[s]) shard_status();
+    }
+    for (size_t b = 0; b + 1 < shards; ++b)
+    {
+        std::copy(bands[b].begin(), bands[b].end(), view.bands[b].points);
+    }
+    bands.clear();
+
+    // the shards split the threads of this process between them
+    const std::string threads = std::to_string(std::max<size_t>(1, sched.size() / shards));
+    std::cout << "Running " << shards << " shards with " << threads << " threads each" << std::endl;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<pid_t> children;
+    for (size_t s = 0; s < shards; ++s)
+    {
+        const std::string index = std::to_string(s);
+        const char* argv[] = { "prmrdl", "shard", name.c_str(), index.c_str(), "--threads", threads.c_str(), nullptr };
+
+        pid_t pid = 0;
+        if (posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, const_cast<char* const*>(argv), environ) != 0)
+        {
+            std::cout << "Unable to start shard " << s << std::endl;
+            header.abort = 1;
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    for (size_t remaining = children.size(); remaining > 0; --remaining)
+    {
+        int status = 0;
+        if (waitpid(-1, &status, 0) < 0)
+        {
+            break;
+        }
+
+        // a shard that dies would leave the others waiting at the barrier
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            header.abort = 1;
+        }
+    }
+
+    bool failed = children.size() != shards;
+    size_t itterations = 0;
+    for (size_t s = 0; s < shards; ++s)
+    {
+        failed = failed || view.status[s].state != shard_done;
+        itterations = std::max<size_t>(itterations, view.status[s].itterations);
+    }
+
+    if (failed)
+    {
+        std::cout << "Sharded run failed" << std::endl;
+        return false;
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Shards converged in " << itterations << " iterations, " << elapsed.count() << "s" << std::endl;
+
+    if (out.image.format == image_format::png)
+    {
+        const auto [min, max] = std::minmax_element(view.raster, view.raster + raster_size * raster_size);
+        return write_png(sched, out.path, raster_size, raster_size, view.raster, *min, *max, out.image);
+    }
+
+    terra::dynarray<tfloat> values(raster_size * raster_size);
+    std::copy(view.raster, view.raster + raster_size * raster_size, values.begin());
+    const auto [min, max] = std::minmax_element(values.begin(), values.end());
+
+    terra::heightfield h;
+    auto bitmap = h.raster<float>(raster_size, raster_size, *min, *max, values);
+    terra::io::write_image(out.path, bitmap);
+
+    return true;
+}
+
+bool configure_shard(const argh::parser& cmdl, const output&, scheduler& sched)
+{
+    const std::string name = cmdl[2];
+    size_t index = 0;
+    if (name.empty() || !(cmdl(3) >> index))
+    {
+        return false;
+    }
+
+    std::unique_ptr<shared_segment> segment;
+    segment_view view;
+    try
+    {
+        segment = std::make_unique<shared_segment>(name, 0, false);
+
+        const auto& header = *reinterpret_cast<const segment_header*>(segment->data());
+        if (header.magic != segment_magic || index >= header.shards)
+        {
+            throw std::runtime_error("not a shard segment");
+        }
+
+        // the band counts sit right behind the header
+        layout_segment(segment->data(), header.shards, header.raster_size, nullptr, view);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Shard " << index << ": " << e.what() << std::endl;
+        std::exit(1);
+    }
+
+    auto& status = view.status[index];
+    try
+    {
+        status.itterations = static_cast<uint32_t>(run_strip(sched, view, index));
+        status.state = shard_done;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Shard " << index << ": " << e.what() << std::endl;
+        status.state = shard_failed;
+        view.header->abort = 1;
+    }
+
+    return true;
+}
+#else
+bool lstgtufe_sharded(const argh::parser&, const output&, scheduler&, const lstgtufe_settings&, size_t)
+{
+    std::cout << "Sharded runs need POSIX shared memory and are only supported on Linux" << std::endl;
+    return false;
+}
+
+bool configure_shard(const argh::parser&, const output&, scheduler&)
+{
+    return false;
+}
+#endif
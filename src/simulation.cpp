@@ -1,17 +1,55 @@
 #include "simulation.hpp"
 
 #include <array>
+#include <functional>
 #include <tuple>
 #include <string_view>
 
 #include "usage.hpp"
 
-bool configure_simulation(const argh::parser& cmdl, const output& out)
+bool configure_hydraulic(const argh::parser& cmdl, const output& out, scheduler& sched, heightmap& map)
 {
-    const std::array<std::tuple<std::string_view, std::string_view>, 2> sim_types =
+    hydraulic_settings settings;
+
+    cmdl(5, settings.steps) >> settings.steps;
+
+    cmdl("--dt",          settings.dt)          >> settings.dt;
+    cmdl("--cell-size",   settings.cell_size)   >> settings.cell_size;
+    cmdl("--rain",        settings.rain)        >> settings.rain;
+    cmdl("--capacity",    settings.capacity)    >> settings.capacity;
+    cmdl("--max-depth",   settings.max_depth)   >> settings.max_depth;
+    cmdl("--dissolve",    settings.dissolve)    >> settings.dissolve;
+    cmdl("--deposit",     settings.deposit)     >> settings.deposit;
+    cmdl("--evaporation", settings.evaporation) >> settings.evaporation;
+
+    hydraulic_erosion(sched, out, map, settings);
+
+    return true;
+}
+
+bool configure_thermal(const argh::parser& cmdl, const output& out, scheduler& sched, heightmap& map)
+{
+    thermal_settings settings;
+
+    cmdl(5, settings.steps) >> settings.steps;
+
+    cmdl("--dt",        settings.dt)          >> settings.dt;
+    cmdl("--cell-size", settings.cell_size)   >> settings.cell_size;
+    cmdl("--talus",     settings.talus_angle) >> settings.talus_angle;
+    cmdl("--rate",      settings.rate)        >> settings.rate;
+
+    thermal_erosion(sched, out, map, settings);
+
+    return true;
+}
+
+bool configure_simulation(const argh::parser& cmdl, const output& out, scheduler& sched)
+{
+    typedef std::function<bool(const argh::parser&, const output&, scheduler&, heightmap&)> sim_t;
+    const std::array<std::tuple<std::string_view, std::string_view, sim_t>, 2> sim_types =
     {
-        std::make_tuple("hydraulic", "desc here pls"),
-        std::make_tuple("thermal", "another desc here pls")
+        std::make_tuple("hydraulic", "virtual pipe water flow with sediment transport", configure_hydraulic),
+        std::make_tuple("thermal", "talus angle material slippage", configure_thermal)
     };
 
     auto type = cmdl[2];
@@ -19,27 +57,31 @@ bool configure_simulation(const argh::parser& cmdl, const output& out)
     {
         print_title();
         std::cout << "Simulation types:" << std::endl;
-        for (const auto& [sim, desc] : sim_types)
+        for (const auto& [sim, desc, _] : sim_types)
         {
             std::cout << sim << " - " << desc << std::endl;
         }
     }
 
-    bool found = false;
-    for (const auto& [sim, _] : sim_types)
+    size_t width;
+    size_t height;
+    cmdl(3, 512ull) >> width;
+    cmdl(4, 512ull) >> height;
+
+    for (const auto& [sim, _, callback] : sim_types)
     {
         if (type == sim)
         {
-            found = true;
-            break;
-        }
-    }
+            heightmap map;
+            if (!load_heightmap(cmdl, width, height, map))
+            {
+                return false;
+            }
 
-    if (!found)
-    {
-        // help stuff here
-        return false;
+            return callback(cmdl, out, sched, map);
+        }
     }
 
-    return true;
-}
\ No newline at end of file
+    // help stuff here
+    return false;
+}
@@ -0,0 +1,164 @@
+#include "simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <terra/terra.hpp>
+
+#include "grid.hpp"
+
+namespace
+{
+    const tfloat slip_epsilon = 1e-6f;
+
+    // steps between progress reports
+    const size_t report_steps = 50;
+
+    enum talus_phase : size_t
+    {
+        material_outflow,
+        material_exchange,
+        talus_phase_count
+    };
+
+    struct talus_model
+    {
+        explicit talus_model(const heightmap& map) : layout(map.width, map.height)
+        {
+            copy_to_grid(map, layout, terrain);
+
+            const size_t cells = layout.cells();
+            out_l.assign(cells, 0.0f);
+            out_r.assign(cells, 0.0f);
+            out_t.assign(cells, 0.0f);
+            out_b.assign(cells, 0.0f);
+        }
+
+        grid_layout layout;
+
+        grid_buffer terrain;
+        grid_buffer out_l;
+        grid_buffer out_r;
+        grid_buffer out_t;
+        grid_buffer out_b;
+    };
+
+    // row kernels take their buffers as restrict parameters so that the
+    // compiler can vectorise them without runtime alias checks
+    void outflow_row(const tfloat* __restrict h,
+                     tfloat* __restrict ol,
+                     tfloat* __restrict orr,
+                     tfloat* __restrict ot,
+                     tfloat* __restrict ob,
+                     size_t count,
+                     size_t stride,
+                     tfloat talus,
+                     tfloat rate)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            const tfloat dl = h[i] - h[i - 1];
+            const tfloat dr = h[i] - h[i + 1];
+            const tfloat dt = h[i] - h[i - stride];
+            const tfloat db = h[i] - h[i + stride];
+
+            // only the height above the talus slope can slip
+            const tfloat el = std::max(0.0f, dl - talus);
+            const tfloat er = std::max(0.0f, dr - talus);
+            const tfloat et = std::max(0.0f, dt - talus);
+            const tfloat eb = std::max(0.0f, db - talus);
+
+            const tfloat excess = el + er + et + eb;
+            const tfloat steepest = std::max(std::max(el, er), std::max(et, eb));
+            const tfloat moved = rate * 0.5f * steepest / std::max(excess, slip_epsilon);
+
+            ol[i] = el * moved;
+            orr[i] = er * moved;
+            ot[i] = et * moved;
+            ob[i] = eb * moved;
+        }
+    }
+
+    void exchange_row(const tfloat* __restrict ol,
+                      const tfloat* __restrict orr,
+                      const tfloat* __restrict ot,
+                      const tfloat* __restrict ob,
+                      tfloat* __restrict h,
+                      size_t count,
+                      size_t stride)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            const tfloat inflow = orr[i - 1] + ol[i + 1] + ob[i - stride] + ot[i + stride];
+            const tfloat outflow = ol[i] + orr[i] + ot[i] + ob[i];
+
+            h[i] += inflow - outflow;
+        }
+    }
+
+    void compute_outflow(talus_model& m, tfloat talus, tfloat rate, size_t row_begin, size_t row_end)
+    {
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            const size_t i = m.layout.index(0, y);
+            outflow_row(&m.terrain[i],
+                        &m.out_l[i],
+                        &m.out_r[i],
+                        &m.out_t[i],
+                        &m.out_b[i],
+                        m.layout.width,
+                        m.layout.stride,
+                        talus,
+                        rate);
+        }
+    }
+
+    void exchange_material(talus_model& m, size_t row_begin, size_t row_end)
+    {
+        for (size_t y = row_begin; y < row_end; ++y)
+        {
+            const size_t i = m.layout.index(0, y);
+            exchange_row(&m.out_l[i],
+                         &m.out_r[i],
+                         &m.out_t[i],
+                         &m.out_b[i],
+                         &m.terrain[i],
+                         m.layout.width,
+                         m.layout.stride);
+        }
+    }
+}
+
+void thermal_erosion(scheduler& sched, const output& out, heightmap& map, const thermal_settings& settings)
+{
+    talus_model model(map);
+
+    const tfloat talus = std::tan(settings.talus_angle * terra::math::PI / 180.0f) * settings.cell_size;
+    const tfloat rate = std::clamp(settings.rate * settings.dt, 0.0f, 1.0f);
+
+    auto kernel = [&](size_t phase, size_t row_begin, size_t row_end)
+    {
+        switch (phase)
+        {
+            case material_outflow:  compute_outflow(model, talus, rate, row_begin, row_end); break;
+            case material_exchange: exchange_material(model, row_begin, row_end); break;
+        }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < settings.steps; done += report_steps)
+    {
+        const size_t steps = std::min(report_steps, settings.steps - done);
+        run_row_tiled(sched, map.height, steps, talus_phase_count, kernel);
+
+        std::cout << "Thermal erosion: " << (done + steps) << "/" << settings.steps << " steps" << std::endl;
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Thermal erosion completed in " << elapsed.count() << "s" << std::endl;
+
+    copy_from_grid(model.terrain, model.layout, map);
+    write_heightmap(sched, out, map);
+}
@@ -0,0 +1,641 @@
+#include "tile_server.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <terra/terra.hpp>
+
+#include "noise.hpp"
+
+#ifdef __unix__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __unix__
+namespace
+{
+    const size_t max_tile_size = 4096;
+    const size_t max_lod = 16;
+
+    // connections served at once, each has a thread of its own
+    const size_t max_clients = 64;
+
+    typedef std::vector<float> tile_t;
+    typedef std::shared_ptr<const tile_t> tile_ptr;
+
+    struct tile_request
+    {
+        std::string type;
+        noise_settings settings;
+        size_t lod = 0;
+
+        // identifies the tile in the cache and names its spill file, the
+        // scale is written with enough digits that distinct scales never
+        // share a key
+        std::string key() const
+        {
+            std::ostringstream key;
+            key << this->type << '_' << this->settings.x_off << '_' << this->settings.y_off << '_'
+                << this->settings.x_size << '_' << this->lod << '_' << this->settings.seed << '_'
+                << this->settings.octaves << '_'
+                << std::setprecision(std::numeric_limits<decltype(this->settings.scale)>::max_digits10) << this->settings.scale;
+
+            return key.str();
+        }
+    };
+
+    bool parse_request(std::istringstream& fields, tile_request& request, std::string& error)
+    {
+        size_t size = 0;
+        if (!(fields >> request.type >> request.settings.x_off >> request.settings.y_off >> size))
+        {
+            error = "expected tile <type> <x_off> <y_off> <size> [lod] [seed] [octaves] [scale]";
+            return false;
+        }
+
+        fields >> request.lod >> request.settings.seed >> request.settings.octaves >> request.settings.scale;
+
+        if (size == 0 || size > max_tile_size)
+        {
+            error = "size must be between 1 and " + std::to_string(max_tile_size);
+            return false;
+        }
+        if (request.lod > max_lod)
+        {
+            error = "lod must be at most " + std::to_string(max_lod);
+            return false;
+        }
+
+        request.settings.x_size = size;
+        request.settings.y_size = size;
+
+        return true;
+    }
+
+    enum struct tile_source
+    {
+        hit,
+        miss,
+        shared
+    };
+
+    // Size bounded LRU of finished tiles plus the tiles being generated.
+    // Spill files are bounded by `spill_capacity`, the oldest are removed
+    // first, and every spill file is removed with the cache.
+    class tile_cache
+    {
+    public:
+        tile_cache(size_t capacity, const std::string& spill_dir, size_t spill_capacity) : capacity(capacity), spill_dir(spill_dir), spill_capacity(spill_capacity)
+        {
+        }
+
+        ~tile_cache()
+        {
+            for (const auto& key : this->spill_order)
+            {
+                std::error_code error;
+                std::filesystem::remove(this->spill_path(key), error);
+            }
+        }
+
+        // Returns the cached tile, or the tile being generated for the same
+        // key, or starts generating it with `generate`.
+        tile_ptr get(scheduler& sched, const std::string& key, const std::function<tile_ptr()>& generate, tile_source& source)
+        {
+            std::shared_future<tile_ptr> pending;
+            std::shared_ptr<std::promise<tile_ptr>> promise;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+
+                auto found = this->entries.find(key);
+                if (found != this->entries.end())
+                {
+                    this->lru.splice(this->lru.begin(), this->lru, found->second);
+                    ++this->hits;
+                    source = tile_source::hit;
+                    return found->second->tile;
+                }
+
+                auto running = this->in_flight.find(key);
+                if (running != this->in_flight.end())
+                {
+                    pending = running->second;
+                    ++this->shared;
+                    source = tile_source::shared;
+                }
+                else
+                {
+                    promise = std::make_shared<std::promise<tile_ptr>>();
+                    pending = promise->get_future().share();
+                    this->in_flight.emplace(key, pending);
+                    ++this->misses;
+                    source = tile_source::miss;
+                }
+            }
+
+            if (promise)
+            {
+                sched.submit([this, key, generate, promise]()
+                {
+                    try
+                    {
+                        auto tile = this->read_spill(key);
+                        if (!tile)
+                        {
+                            tile = generate();
+                        }
+
+                        this->insert(key, tile);
+                        promise->set_value(tile);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        this->in_flight.erase(key);
+                        promise->set_exception(std::current_exception());
+                    }
+                });
+            }
+
+            return pending.get();
+        }
+
+        std::string stats()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            std::ostringstream line;
+            line << "ok " << this->hits << ' ' << this->misses << ' ' << this->shared << ' '
+                 << this->spilled << ' ' << this->evicted << ' ' << this->bytes;
+
+            return line.str();
+        }
+
+    private:
+        struct entry_t
+        {
+            std::string key;
+            tile_ptr tile;
+        };
+
+        static size_t tile_bytes(const tile_ptr& tile)
+        {
+            return tile->size() * sizeof(float);
+        }
+
+        void insert(const std::string& key, const tile_ptr& tile)
+        {
+            std::vector<entry_t> evicted_entries;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->in_flight.erase(key);
+
+                this->lru.push_front({ key, tile });
+                this->entries[key] = this->lru.begin();
+                this->bytes += tile_bytes(tile);
+
+                // the newest tile always stays, even when it alone is over capacity
+                while (this->bytes > this->capacity && this->lru.size() > 1)
+                {
+                    auto& oldest = this->lru.back();
+                    this->bytes -= tile_bytes(oldest.tile);
+                    this->entries.erase(oldest.key);
+                    evicted_entries.push_back(std::move(oldest));
+                    this->lru.pop_back();
+                    ++this->evicted;
+                }
+            }
+
+            // disk writes happen outside the lock
+            for (const auto& entry : evicted_entries)
+            {
+                this->write_spill(entry.key, entry.tile);
+            }
+        }
+
+        std::filesystem::path spill_path(const std::string& key) const
+        {
+            return std::filesystem::path(this->spill_dir) / (key + ".tile");
+        }
+
+        void write_spill(const std::string& key, const tile_ptr& tile)
+        {
+            if (this->spill_dir.empty())
+            {
+                return;
+            }
+
+            // a tile read back from its spill file is still on disk
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (this->spill_bytes_of.count(key) != 0)
+                {
+                    return;
+                }
+            }
+
+            // written under a temporary name so a reader never sees half a tile
+            const auto path = this->spill_path(key);
+            auto temp = path;
+            temp += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+            std::ofstream file(temp, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(tile->data()), static_cast<std::streamsize>(tile_bytes(tile)));
+            file.close();
+
+            std::error_code error;
+            std::filesystem::rename(temp, path, error);
+            if (error)
+            {
+                std::filesystem::remove(temp, error);
+                return;
+            }
+
+            std::vector<std::string> removed;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (!this->spill_bytes_of.emplace(key, tile_bytes(tile)).second)
+                {
+                    return;
+                }
+                this->spill_order.push_back(key);
+                this->spill_bytes += tile_bytes(tile);
+                ++this->spilled;
+
+                // the newest spill file always stays, like the newest tile
+                while (this->spill_bytes > this->spill_capacity && this->spill_order.size() > 1)
+                {
+                    const auto& oldest = this->spill_order.front();
+                    this->spill_bytes -= this->spill_bytes_of[oldest];
+                    this->spill_bytes_of.erase(oldest);
+                    removed.push_back(std::move(this->spill_order.front()));
+                    this->spill_order.pop_front();
+                }
+            }
+
+            for (const auto& old : removed)
+            {
+                std::filesystem::remove(this->spill_path(old), error);
+            }
+        }
+
+        tile_ptr read_spill(const std::string& key) const
+        {
+            if (this->spill_dir.empty())
+            {
+                return nullptr;
+            }
+
+            std::ifstream file(this->spill_path(key), std::ios::binary | std::ios::ate);
+            if (!file)
+            {
+                return nullptr;
+            }
+
+            auto tile = std::make_shared<tile_t>(static_cast<size_t>(file.tellg()) / sizeof(float));
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(tile->data()), static_cast<std::streamsize>(tile->size() * sizeof(float)));
+
+            return file ? tile : nullptr;
+        }
+
+        size_t capacity;
+        std::string spill_dir;
+        size_t spill_capacity;
+
+        std::list<entry_t> lru;
+        std::unordered_map<std::string, std::list<entry_t>::iterator> entries;
+        std::unordered_map<std::string, std::shared_future<tile_ptr>> in_flight;
+        std::deque<std::string> spill_order;
+        std::unordered_map<std::string, size_t> spill_bytes_of;
+        std::mutex mutex;
+
+        size_t bytes = 0;
+        size_t spill_bytes = 0;
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t shared = 0;
+        size_t spilled = 0;
+        size_t evicted = 0;
+    };
+
+    bool write_all(int fd, const void* data, size_t size)
+    {
+        auto bytes = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            const ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+            if (written <= 0)
+            {
+                return false;
+            }
+
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    }
+
+    bool write_line(int fd, const std::string& line)
+    {
+        return write_all(fd, (line + "\n").data(), line.size() + 1);
+    }
+
+    // Reads up to the next newline, keeping whatever follows it in `buffer`.
+    bool read_line(int fd, std::string& buffer, std::string& line)
+    {
+        while (true)
+        {
+            const auto newline = buffer.find('\n');
+            if (newline != std::string::npos)
+            {
+                line = buffer.substr(0, newline);
+                buffer.erase(0, newline + 1);
+                return true;
+            }
+
+            char chunk[4096];
+            const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received <= 0)
+            {
+                return false;
+            }
+            buffer.append(chunk, static_cast<size_t>(received));
+        }
+    }
+
+    class tile_server
+    {
+    public:
+        tile_server(scheduler& sched, size_t capacity, const std::string& spill_dir, size_t spill_capacity) : sched(sched), cache(capacity, spill_dir, spill_capacity), listener(-1), stopping(false)
+        {
+        }
+
+        bool run(const std::string& socket_path)
+        {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (socket_path.size() >= sizeof(address.sun_path))
+            {
+                std::cout << "Socket path is too long: " << socket_path << std::endl;
+                return false;
+            }
+            std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+
+            this->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(socket_path.c_str());
+            if (this->listener < 0
+                || bind(this->listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+                || listen(this->listener, 64) != 0)
+            {
+                std::cout << "Unable to listen on " << socket_path << std::endl;
+                if (this->listener >= 0)
+                {
+                    close(this->listener);
+                }
+                return false;
+            }
+
+            std::cout << "Serving tiles on " << socket_path << " with " << this->sched.size() << " threads" << std::endl;
+
+            while (!this->stopping)
+            {
+                const int client = accept(this->listener, nullptr, nullptr);
+                if (client < 0)
+                {
+                    const int error = errno;
+                    if (this->stopping || error == EINTR || error == ECONNABORTED)
+                    {
+                        continue;
+                    }
+
+                    // out of descriptors or memory, wait for connections to close
+                    if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                        continue;
+                    }
+
+                    std::cout << "Unable to accept connections: " << std::strerror(error) << std::endl;
+                    this->stop();
+                    break;
+                }
+
+                // connections are detached and counted through `clients`
+                // so a long running server does not collect finished threads
+                bool busy = false;
+                {
+                    std::lock_guard<std::mutex> lock(this->clients_mutex);
+                    busy = this->clients.size() >= max_clients;
+                    if (!busy)
+                    {
+                        this->clients.push_back(client);
+                    }
+                }
+                if (busy)
+                {
+                    write_line(client, "error too many connections");
+                    close(client);
+                    continue;
+                }
+                std::thread(&tile_server::serve, this, client).detach();
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(this->clients_mutex);
+                this->disconnected.wait(lock, [this]() { return this->clients.empty(); });
+            }
+
+            close(this->listener);
+            unlink(socket_path.c_str());
+
+            std::cout << "Tile server stopped, " << this->cache.stats().substr(3) << std::endl;
+
+            return true;
+        }
+
+    private:
+        void serve(int client)
+        {
+            std::string buffer;
+            std::string line;
+            while (read_line(client, buffer, line))
+            {
+                std::istringstream fields(line);
+                std::string command;
+                fields >> command;
+
+                bool ok = true;
+                if (command == "tile")
+                {
+                    ok = this->serve_tile(client, fields);
+                }
+                else if (command == "stats")
+                {
+                    ok = write_line(client, this->cache.stats());
+                }
+                else if (command == "quit")
+                {
+                    write_line(client, "ok");
+                    this->stop();
+                    break;
+                }
+                else
+                {
+                    ok = write_line(client, "error unknown command \"" + command + "\"");
+                }
+
+                if (!ok)
+                {
+                    break;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(this->clients_mutex);
+            this->clients.erase(std::find(this->clients.begin(), this->clients.end(), client));
+            close(client);
+            this->disconnected.notify_all();
+        }
+
+        bool serve_tile(int client, std::istringstream& fields)
+        {
+            tile_request request;
+            std::string error;
+            if (!parse_request(fields, request, error))
+            {
+                return write_line(client, "error " + error);
+            }
+
+            // a coarser level samples the same field at a lower frequency
+            request.settings.scale *= static_cast<float>(size_t(1) << request.lod);
+
+            auto generate = [this, request]()
+            {
+                terra::dynarray<tfloat> values(0);
+                if (!generate_noise(request.type, request.settings, values))
+                {
+                    throw std::runtime_error("unknown noise type \"" + request.type + "\"");
+                }
+
+                return std::make_shared<const tile_t>(values.begin(), values.end());
+            };
+
+            tile_ptr tile;
+            tile_source source = tile_source::miss;
+            try
+            {
+                tile = this->cache.get(this->sched, request.key(), generate, source);
+            }
+            catch (const std::exception& e)
+            {
+                return write_line(client, std::string("error ") + e.what());
+            }
+
+            const char* sources[] = { "hit", "miss", "shared" };
+            const size_t bytes = tile->size() * sizeof(float);
+
+            std::ostringstream header;
+            header << "ok " << request.settings.x_size << ' ' << request.settings.y_size << ' ' << bytes << ' '
+                   << sources[static_cast<size_t>(source)];
+
+            return write_line(client, header.str()) && write_all(client, tile->data(), bytes);
+        }
+
+        void stop()
+        {
+            this->stopping = true;
+
+            // wakes accept() and every connection blocked in recv()
+            shutdown(this->listener, SHUT_RDWR);
+            std::lock_guard<std::mutex> lock(this->clients_mutex);
+            for (const int client : this->clients)
+            {
+                shutdown(client, SHUT_RDWR);
+            }
+        }
+
+        scheduler& sched;
+        tile_cache cache;
+
+        int listener;
+        std::atomic<bool> stopping;
+
+        std::vector<int> clients;
+        std::mutex clients_mutex;
+        std::condition_variable disconnected;
+    };
+}
+
+bool configure_serve(const argh::parser& cmdl, const output&, scheduler& sched)
+{
+    const std::string socket_path = cmdl[2];
+    if (socket_path.empty())
+    {
+        return false;
+    }
+
+    size_t cache_mb = 256;
+    size_t spill_mb = 1024;
+    std::string spill_dir;
+    cmdl("--cache-mb", 256) >> cache_mb;
+    cmdl("--spill-mb", 1024) >> spill_mb;
+    cmdl("--spill", "") >> spill_dir;
+
+    bool created = false;
+    if (!spill_dir.empty())
+    {
+        std::error_code error;
+        created = std::filesystem::create_directories(spill_dir, error);
+        if (error)
+        {
+            std::cout << "Unable to create spill directory " << spill_dir << ": " << error.message()
+                      << ", evicted tiles are dropped" << std::endl;
+            spill_dir.clear();
+        }
+    }
+
+    {
+        tile_server server(sched, cache_mb << 20, spill_dir, spill_mb << 20);
+        server.run(socket_path);
+    }
+
+    // the spill files are gone with the server, a directory it created goes too
+    if (created)
+    {
+        std::error_code error;
+        std::filesystem::remove(spill_dir, error);
+    }
+
+    return true;
+}
+#else
+bool configure_serve(const argh::parser&, const output&, scheduler&)
+{
+    std::cout << "The tile server needs Unix domain sockets" << std::endl;
+    return true;
+}
+#endif
@@ -8,4 +8,22 @@ void print_title()
 void print_usage()
 {
     std::cout << "Usage: prmrdl verb output_type<hf,mdl> <output_path> [args...]" << std::endl;
+    std::cout << "  --threads <n>                       worker threads, 0 uses every hardware thread" << std::endl;
+    std::cout << "  --affinity <none,compact,scatter>   pin workers to cpus, scatter spreads them over NUMA nodes" << std::endl;
+    std::cout << "  --scheduler-stats                   print per worker task, steal and idle counts" << std::endl;
+    std::cout << "  --profile                           print per stage time and heap allocations of lstgtufe and noise" << std::endl;
+    std::cout << "  --perf                              profile with hardware counters, IPC and misses per node of every stage" << std::endl;
+    std::cout << "  --shards <n>                        run lstgtufe as n processes over vertical strips of the domain" << std::endl;
+    std::cout << "  --overlap <distance>                half width of the band shared by neighbouring strips" << std::endl;
+    std::cout << "  --ensemble <members>                erode one lstgtufe mesh once per line of uplift, erosion rate and time scale" << std::endl;
+    std::cout << "  --adaptive                          let lstgtufe grow and shrink its time step as the terrain settles" << std::endl;
+    std::cout << "  --density <source>                  sample lstgtufe finely where uplift, presolve or map relief is high" << std::endl;
+    std::cout << "  --coarsen <n>                       radius multiple used by --density where the relief is flat (4)" << std::endl;
+    std::cout << "  --save-state <path>                 save the converged lstgtufe nodes and heights" << std::endl;
+    std::cout << "  --warm-start <path>                 start lstgtufe from a saved state, interpolated onto a different mesh" << std::endl;
+    std::cout << "  --bits <8,16>                       sample depth of png heightfields" << std::endl;
+    std::cout << "  --png-level <0-9>                   deflate level of png heightfields, strips are compressed in parallel" << std::endl;
+    std::cout << "  --raster <n>                        width and height of rasterised lstgtufe heightfields" << std::endl;
+    std::cout << "  --storage <dir>                     map lstgtufe's step and neighbour buffers from scratch files in dir, the mesh stays in memory" << std::endl;
+    std::cout << "  --reorder                           sort lstgtufe nodes along a Hilbert curve for locality" << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,241 @@
+#include "warm_start.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+#include "point_grid.hpp"
+
+namespace
+{
+    const uint64_t state_magic = 0x70726d72646c0002;
+    const size_t node_grain = 4096;
+
+    struct state_header
+    {
+        uint64_t magic;
+        uint64_t width;
+        uint64_t height;
+        uint64_t itterations;
+        uint64_t nodes;
+    };
+
+    // Saved nodes within this many mean spacings of a node contribute to its
+    // interpolated height.
+    const tfloat interpolation_reach = 1.5f;
+}
+
+bool write_lstgtufe_state(const std::string& path,
+                          const lstgtufe_mesh& mesh,
+                          const terra::dynarray<tfloat>& heights,
+                          size_t itterations)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Unable to open state: " << path << std::endl;
+        return false;
+    }
+
+    const size_t node_count = mesh.points.size();
+    const state_header header = { state_magic, mesh.width, mesh.height, itterations, node_count };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<float> raw(node_count * 2);
+    for (size_t i = 0; i < node_count; ++i)
+    {
+        raw[i * 2] = static_cast<float>(mesh.points[i].x);
+        raw[i * 2 + 1] = static_cast<float>(mesh.points[i].y);
+    }
+    file.write(reinterpret_cast<const char*>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(float)));
+
+    raw.assign(heights.begin(), heights.end());
+    file.write(reinterpret_cast<const char*>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(float)));
+
+    if (!file)
+    {
+        std::cout << "Unable to write state: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool read_lstgtufe_state(const std::string& path, lstgtufe_state& state)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Unable to open state: " << path << std::endl;
+        return false;
+    }
+
+    state_header header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (static_cast<size_t>(file.gcount()) != sizeof(header) || header.magic != state_magic)
+    {
+        std::cout << "\"" << path << "\" is not an lstgtufe state" << std::endl;
+        return false;
+    }
+
+    // the header is checked against the file before anything is allocated
+    const auto nodes_begin = file.tellg();
+    file.seekg(0, std::ios::end);
+    const auto remaining = static_cast<uint64_t>(file.tellg() - nodes_begin);
+    file.seekg(nodes_begin);
+    if (header.nodes > remaining / (3 * sizeof(float)))
+    {
+        std::cout << "State \"" << path << "\" is smaller than its " << header.nodes << " nodes" << std::endl;
+        return false;
+    }
+
+    const size_t node_count = static_cast<size_t>(header.nodes);
+    std::vector<float> raw(node_count * 3);
+    file.read(reinterpret_cast<char*>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(float)));
+    if (static_cast<size_t>(file.gcount()) != raw.size() * sizeof(float))
+    {
+        std::cout << "State \"" << path << "\" is smaller than its " << node_count << " nodes" << std::endl;
+        return false;
+    }
+
+    state.width = static_cast<size_t>(header.width);
+    state.height = static_cast<size_t>(header.height);
+    state.itterations = static_cast<size_t>(header.itterations);
+    state.points.resize(node_count);
+    for (size_t i = 0; i < node_count; ++i)
+    {
+        state.points[i] = { raw[i * 2], raw[i * 2 + 1] };
+    }
+    state.heights.assign(raw.begin() + static_cast<ptrdiff_t>(node_count * 2), raw.end());
+
+    return true;
+}
+
+bool warm_start_heights(scheduler& sched,
+                        const lstgtufe_mesh& mesh,
+                        const lstgtufe_state& state,
+                        terra::dynarray<tfloat>& heights)
+{
+    if (state.width != mesh.width || state.height != mesh.height || state.points.empty())
+    {
+        std::cout << "State covers " << state.width << "x" << state.height << ", not the "
+                  << mesh.width << "x" << mesh.height << " of the mesh" << std::endl;
+        return false;
+    }
+
+    const size_t node_count = mesh.points.size();
+    heights = terra::dynarray<tfloat>(node_count);
+
+    // the sampler is deterministic, so the same options give the same nodes
+    if (state.points.size() == node_count && std::equal(state.points.begin(), state.points.end(), mesh.points.begin(), [](const terra::vec2& a, const terra::vec2& b)
+        {
+            return a.x == b.x && a.y == b.y;
+        }))
+    {
+        std::copy(state.heights.begin(), state.heights.end(), heights.begin());
+        std::cout << "Warm start copied " << node_count << " node heights" << std::endl;
+
+        return true;
+    }
+
+    const tfloat spacing = std::sqrt(static_cast<tfloat>(state.width) * static_cast<tfloat>(state.height) / static_cast<tfloat>(state.points.size()));
+    const tfloat reach = interpolation_reach * spacing;
+    const point_grid grid(state.points, spacing);
+
+    sched.parallel_for(0, node_count, node_grain, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const auto& p = mesh.points[i];
+
+            double weighted = 0.0;
+            double weights = 0.0;
+            bool exact = false;
+            grid.for_each_within(p, reach, [&](size_t j)
+            {
+                if (exact)
+                {
+                    return;
+                }
+
+                const tfloat dx = state.points[j].x - p.x;
+                const tfloat dy = state.points[j].y - p.y;
+                const tfloat d2 = dx * dx + dy * dy;
+                if (d2 == 0.0f)
+                {
+                    weighted = state.heights[j];
+                    weights = 1.0;
+                    exact = true;
+                    return;
+                }
+
+                weighted += state.heights[j] / d2;
+                weights += 1.0 / d2;
+            });
+
+            if (weights > 0.0)
+            {
+                heights[i] = static_cast<tfloat>(weighted / weights);
+                continue;
+            }
+
+            const size_t nearest = grid.nearest(p);
+            heights[i] = nearest == point_grid::npos ? 0.0f : state.heights[nearest];
+        }
+    });
+
+    std::cout << "Warm start interpolated " << node_count << " node heights from " << state.points.size() << " saved nodes" << std::endl;
+
+    return true;
+}
+
+size_t lstgtufe_warm_start(scheduler& sched,
+                           const std::string& path,
+                           const lstgtufe_mesh& mesh,
+                           terra::dynarray<tfloat>& heights)
+{
+    if (path.empty())
+    {
+        return 0;
+    }
+
+    lstgtufe_state state;
+    if (!read_lstgtufe_state(path, state) || !warm_start_heights(sched, mesh, state, heights))
+    {
+        std::cout << "Starting from flat ground" << std::endl;
+        heights = terra::dynarray<tfloat>(0);
+        return 0;
+    }
+
+    return std::max<size_t>(1, state.itterations);
+}
+
+void lstgtufe_save_state(const std::string& path,
+                         const lstgtufe_mesh& mesh,
+                         const terra::dynarray<tfloat>& heights,
+                         size_t itterations,
+                         size_t saved_from)
+{
+    if (saved_from > 0)
+    {
+        std::cout << "Warm start took " << itterations << " iterations, the saved run took " << saved_from;
+        if (saved_from > itterations)
+        {
+            std::cout << ", " << saved_from - itterations << " saved";
+        }
+        std::cout << std::endl;
+    }
+
+    if (path.empty())
+    {
+        return;
+    }
+
+    // a chain of warm starts keeps comparing against the run from flat ground
+    if (write_lstgtufe_state(path, mesh, heights, saved_from > 0 ? saved_from : itterations))
+    {
+        std::cout << "State saved: " << path << std::endl;
+    }
+}